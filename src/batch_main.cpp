@@ -0,0 +1,115 @@
+// Headless batch driver: steps the simulation as fast as the hardware allows
+// and writes the same .bgeo caches as the viewer's recording mode. Built with
+// SMOKE_HEADLESS, so it links without OpenGL or GLUT.
+//
+// usage: SMOKE_BATCH <frames> <resolution> <output directory> [threads] [format] [checkpoint interval]
+//   resolution  N for an N^3 grid, or XxYxZ
+//   threads     0 (default) uses every core, 1 runs serially
+//   format      bgeo (default), vol or both, see cache_writer.h
+//   checkpoint  saves <output directory>/checkpoint.ckp every that many
+//               frames, 0 (default) never does. A run started on a directory
+//               that holds a checkpoint resumes from it.
+//
+// SMOKE_PROFILE=<file.csv|file.json> in the environment writes per-frame stage
+// timings and solver statistics to that file and prints a summary at exit.
+// SMOKE_WARM_START=1 seeds every pressure solve with the pressure of the last
+// frame instead of 0. SMOKE_SCENE=<file> takes the smoke sources from a scene
+// file (see emitter.h) instead of the built-in ones.
+
+#include "smoke_sim.h"
+#include "constants.h"
+#include "parallel.h"
+#include "custom_output.h"
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <direct.h>
+#define makeDirectory(path) _mkdir(path)
+#else
+#include <sys/stat.h>
+#define makeDirectory(path) mkdir(path, 0755)
+#endif
+
+static bool parseResolution(const char* text, int dim[3])
+{
+   int n = sscanf(text, "%dx%dx%d", &dim[0], &dim[1], &dim[2]);
+   if (n == 1) dim[1] = dim[2] = dim[0];
+   else if (n != 3) return false;
+   return dim[0] > 0 && dim[1] > 0 && dim[2] > 0;
+}
+
+static int parseFormat(const char* text)
+{
+   if (strcmp(text, "bgeo") == 0) return CacheWriter::BGEO;
+   if (strcmp(text, "vol") == 0) return CacheWriter::VOLUME;
+   if (strcmp(text, "both") == 0) return CacheWriter::BGEO | CacheWriter::VOLUME;
+   return 0;
+}
+
+int main(int argc, char **argv)
+{
+   int dim[3];
+   int formats = argc > 5 ? parseFormat(argv[5]) : CacheWriter::BGEO;
+   if (argc < 4 || atoi(argv[1]) <= 0 || !parseResolution(argv[2], dim) || formats == 0)
+   {
+      fprintf(stderr, "usage: %s <frames> <resolution N or XxYxZ> <output directory> [threads] [bgeo|vol|both] [checkpoint interval]\n", argv[0]);
+      return 1;
+   }
+   const int frames = atoi(argv[1]);
+   const std::string directory = argv[3];
+   const int checkpointInterval = argc > 6 ? atoi(argv[6]) : 0;
+   const std::string checkpoint = directory + "/checkpoint.ckp";
+   if (argc > 4) Parallel::setNumThreads(atoi(argv[4]));
+   makeDirectory(directory.c_str()); // Fails harmlessly if it already exists.
+
+   SimConfig config;
+   config.setDimensions(dim[0], dim[1], dim[2]);
+   SmokeSim sim(config);
+   sim.setCacheFormats(formats);
+   sim.setCheckpointInterval(checkpointInterval, checkpoint);
+   if (const char* profile = getenv("SMOKE_PROFILE")) sim.setProfileOutput(profile);
+   if (const char* warm = getenv("SMOKE_WARM_START")) MACGrid::theWarmStart = atoi(warm) != 0;
+   if (const char* scene = getenv("SMOKE_SCENE"))
+   {
+      if (!sim.loadScene(scene)) return 1;
+   }
+
+   // The checkpoint holds the state after its last frame. The caches of the
+   // frames before it were flushed when it was saved, only the cache of that
+   // frame itself may have been lost with the interrupted run and is rewritten.
+   int firstFrame = 0;
+   if (sim.loadCheckpoint(checkpoint))
+   {
+      const SimConfig& loaded = sim.getConfig();
+      if (loaded.dim[0] != dim[0] || loaded.dim[1] != dim[1] || loaded.dim[2] != dim[2])
+      {
+         fprintf(stderr, "%s was written for a %dx%dx%d grid\n", checkpoint.c_str(), loaded.dim[0], loaded.dim[1], loaded.dim[2]);
+         return 1;
+      }
+      firstFrame = sim.getTotalFrames();
+      if (firstFrame > 0) sim.writeCache(directory, firstFrame - 1);
+      PRINT_LINE("Resuming from " << checkpoint << " at frame " << firstFrame);
+   }
+
+   PRINT_LINE("Simulating " << frames << " frames on a " << dim[0] << "x" << dim[1] << "x" << dim[2]
+              << " grid with " << Parallel::numThreads() << " thread(s) into " << directory);
+
+   typedef std::chrono::steady_clock Clock;
+   Clock::time_point start = Clock::now();
+   for (int frame = firstFrame; frame < frames; frame++)
+   {
+      Clock::time_point frameStart = Clock::now();
+      sim.step();
+      sim.writeCache(directory, frame);
+      double seconds = std::chrono::duration<double>(Clock::now() - frameStart).count();
+      PRINT_LINE("Frame " << frame << " done in " << seconds << " s");
+   }
+   sim.flushCache();
+   double total = std::chrono::duration<double>(Clock::now() - start).count();
+   PRINT_LINE("Total " << total << " s, " << total / std::max(frames - firstFrame, 1) << " s per frame");
+
+   return 0;
+}
@@ -0,0 +1,200 @@
+// Benchmark of the solver kernels: GridData::interpolate, velocity and scalar
+// advection, vorticity confinement, the pressure matrix product, one PCG
+// solve and a full SmokeSim::step, on a series of cubic grids. Built with
+// SMOKE_HEADLESS like the batch driver.
+//
+// usage: SMOKE_BENCH [-t threads] [-r repetitions] [N ...]
+//   N            grid sizes, 32 64 128 256 by default
+//   threads      0 (default) uses every core, 1 runs serially
+//   repetitions  timed runs of every kernel after one warm-up run, 5 by default
+//
+// All inputs come from fixed seeds and every grid size starts from the same
+// state, so runs are comparable between builds. Each kernel reports its
+// median run in ms, in ns per cell (per sample for interpolate) and, where
+// it has a simple traffic model, in GB/s of compulsory memory traffic: the
+// fields it has to read and write, each touched once per cell.
+
+#include "smoke_sim.h"
+#include "constants.h"
+#include "parallel.h"
+#include "random.h"
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+// MACGrid with the stages and the pressure system the benchmark needs.
+class BenchGrid : public MACGrid
+{
+public:
+   explicit BenchGrid(const SimConfig& config) : MACGrid(config) {}
+
+   using MACGrid::computeVorticityConfinement;
+
+   const GridDataMatrix& matrix() const { return AMatrix; }
+
+   // Random values in [-1, 1) in the fluid cells, 0 in the solid cells,
+   // which the solver leaves out.
+   void fillRandom(GridData& x, Random& random)
+   {
+      GridKernels::fill(x, 0.0);
+      for (int j = 0; j < mConfig.dim[1]; j++)
+         for (int k = 0; k < mConfig.dim[2]; k++)
+            for (int i = 0; i < mConfig.dim[0]; i++)
+               if (!mSolids.isSolid(i, j, k)) x(i, j, k) = 2.0 * random.uniform() - 1.0;
+   }
+
+   // Solves to a residual of 1e-6 relative to d, as project() does on large right hand sides.
+   void solvePressure(GridData& p, const GridData& d)
+   {
+      preconditionedConjugateGradient(AMatrix, p, d, 500, 0.000001 * GridKernels::maxMagnitude(d));
+   }
+};
+
+struct Result
+{
+   const char* kernel;
+   double seconds;       // Median run.
+   double items;         // Cells, or samples for interpolate.
+   double bytesPerItem;  // Compulsory traffic, 0 without a model.
+   int iterations;       // Solver iterations, 0 if not a solve.
+};
+
+static const double DT = 0.1;
+static const int SETUP_FRAMES = 3; // Steps run before timing, so the fields hold moving smoke.
+static const int MAX_SAMPLES = 1 << 21;
+
+// Median time of repetitions runs of run(), after one untimed warm-up run.
+template <class Run> static double medianSeconds(int repetitions, Run run)
+{
+   typedef std::chrono::steady_clock Clock;
+   run();
+   std::vector<double> seconds(repetitions);
+   for (int r = 0; r < repetitions; r++)
+   {
+      Clock::time_point start = Clock::now();
+      run();
+      seconds[r] = std::chrono::duration<double>(Clock::now() - start).count();
+   }
+   std::sort(seconds.begin(), seconds.end());
+   return seconds[repetitions / 2];
+}
+
+static void benchGrid(int n, int repetitions, std::vector<Result>& results)
+{
+   SimConfig config;
+   config.setDimensions(n, n, n);
+   const double cells = (double) n * n * n;
+   const double entry = sizeof(Real);
+
+   BenchGrid grid(config);
+   for (int frame = 0; frame < SETUP_FRAMES; frame++)
+   {
+      grid.updateSources();
+      grid.advectVelocity(DT);
+      grid.addExternalForces(DT);
+      grid.project(DT);
+      grid.advectDensityAndTemperature(DT);
+   }
+
+   // Samples one cell size or less from the cell centers, in storage order,
+   // the access pattern of a semi-Lagrangian back-trace.
+   Random random(1u);
+   const int numSamples = (int) std::min(cells, (double) MAX_SAMPLES);
+   std::vector<vec3> points(numSamples);
+   for (int s = 0; s < numSamples; s++)
+   {
+      int i = s % n, k = (s / n) % n, j = s / (n * n);
+      points[s] = vec3(i + random.uniform(), j + random.uniform(), k + random.uniform()) * config.cellSize;
+   }
+   const GridData& density = grid.getDensityField();
+   volatile double sink = 0.0;
+   double seconds = medianSeconds(repetitions, [&]() {
+      double sum = 0.0;
+      for (int s = 0; s < numSamples; s++) sum += density.interpolate(points[s]);
+      sink = sum;
+   });
+   results.push_back({ "interpolate", seconds, (double) numSamples, entry + sizeof(vec3) + sizeof(double), 0 });
+   (void) sink;
+
+   seconds = medianSeconds(repetitions, [&]() { grid.advectVelocity(DT); });
+   results.push_back({ "advect_velocity", seconds, cells, 6 * entry, 0 }); // U, V, W in and out.
+
+   seconds = medianSeconds(repetitions, [&]() { grid.advectDensityAndTemperature(DT); });
+   results.push_back({ "advect_scalars", seconds, cells, 7 * entry, 0 }); // U, V, W, D, T in, D, T out.
+
+   seconds = medianSeconds(repetitions, [&]() { grid.computeVorticityConfinement(DT); });
+   results.push_back({ "vorticity", seconds, cells, 6 * entry, 0 }); // U, V, W in and out.
+
+   // The right hand side is A times a random field, so it lies in the range
+   // of A whatever the boundary conditions make of its null space.
+   GridData x, d, p;
+   x.initialize(config);
+   d.initialize(config);
+   p.initialize(config);
+   grid.fillRandom(x, random);
+   seconds = medianSeconds(repetitions, [&]() { GridKernels::apply(grid.matrix(), x, d); });
+   results.push_back({ "apply", seconds, cells, 6 * entry, 0 }); // 4 matrix fields and x in, result out.
+
+   seconds = medianSeconds(repetitions, [&]() {
+      GridKernels::fill(p, 0.0);
+      grid.solvePressure(p, d);
+   });
+   results.push_back({ "pcg_solve", seconds, cells, 0.0, grid.getSolverIterations() });
+}
+
+static void benchStep(int n, int repetitions, std::vector<Result>& results)
+{
+   SimConfig config;
+   config.setDimensions(n, n, n);
+   SmokeSim sim(config);
+   for (int frame = 0; frame < SETUP_FRAMES; frame++) sim.step();
+   double seconds = medianSeconds(repetitions, [&]() { sim.step(); });
+   results.push_back({ "step", seconds, (double) n * n * n, 0.0, 0 });
+}
+
+int main(int argc, char **argv)
+{
+   int repetitions = 5;
+   std::vector<int> sizes;
+   for (int a = 1; a < argc; a++)
+   {
+      if (strcmp(argv[a], "-t") == 0 && a + 1 < argc) Parallel::setNumThreads(atoi(argv[++a]));
+      else if (strcmp(argv[a], "-r") == 0 && a + 1 < argc) repetitions = atoi(argv[++a]);
+      else if (atoi(argv[a]) > 0) sizes.push_back(atoi(argv[a]));
+      else repetitions = 0;
+   }
+   if (repetitions <= 0)
+   {
+      fprintf(stderr, "usage: %s [-t threads] [-r repetitions] [N ...]\n", argv[0]);
+      return 1;
+   }
+   if (sizes.empty()) sizes = { 32, 64, 128, 256 };
+
+   printf("SMOKE_BENCH: %d thread(s), %d repetition(s), %s fields\n", Parallel::numThreads(), repetitions,
+          sizeof(Real) == sizeof(float) ? "float" : "double");
+
+   for (size_t s = 0; s < sizes.size(); s++)
+   {
+      // One grid at a time, 256^3 already takes a few GB.
+      std::vector<Result> results;
+      benchGrid(sizes[s], repetitions, results);
+      benchStep(sizes[s], repetitions, results);
+
+      // After the solver output of the runs above.
+      printf("\n%-16s %5s %12s %10s %8s  %s\n", "kernel", "N", "ms", "ns/cell", "GB/s", "iterations");
+      for (size_t r = 0; r < results.size(); r++)
+      {
+         const Result& result = results[r];
+         char bandwidth[32] = "-", iterations[32] = "";
+         if (result.bytesPerItem > 0) snprintf(bandwidth, sizeof(bandwidth), "%.2f", result.items * result.bytesPerItem / result.seconds * 1e-9);
+         if (result.iterations > 0) snprintf(iterations, sizeof(iterations), "%d", result.iterations);
+         printf("%-16s %5d %12.3f %10.2f %8s  %s\n", result.kernel, sizes[s], 1000.0 * result.seconds,
+                result.seconds / result.items * 1e9, bandwidth, iterations);
+      }
+      fflush(stdout);
+   }
+   return 0;
+}
@@ -0,0 +1,161 @@
+#include "cache_writer.h"
+#include "mac_grid.h"
+#include <Partio.h>
+
+CacheWriter::CacheWriter(int numThreads, int numBuffers) :
+	mFormats(BGEO), mFrames(numBuffers), mBusy(0), mStopping(false)
+{
+	for (size_t f = 0; f < mFrames.size(); f++) mFree.push_back(&mFrames[f]);
+	for (int t = 0; t < numThreads; t++) mThreads.push_back(std::thread(&CacheWriter::run, this));
+}
+
+CacheWriter::~CacheWriter()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStopping = true;
+	}
+	mWorkReady.notify_all();
+	for (size_t t = 0; t < mThreads.size(); t++) mThreads[t].join();
+}
+
+void CacheWriter::write(const MACGrid& grid, const std::string& directory, int frame)
+{
+	Frame* buffer;
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		mBufferFree.wait(lock, [this] { return !mFree.empty(); });
+		buffer = mFree.back();
+		mFree.pop_back();
+	}
+
+	// Plain copies into storage kept from earlier frames, so a snapshot does
+	// not allocate once the buffers have grown to the grid size.
+	buffer->directory = directory;
+	buffer->number = frame;
+	buffer->formats = mFormats;
+	buffer->config = grid.getConfig();
+	if (mFormats & BGEO) {
+		buffer->density = grid.getDensityField();
+		buffer->tiles = grid.getSmokeTiles();
+		buffer->particles = grid.rendering_particles;
+	}
+	if (mFormats & VOLUME) {
+		std::vector<VolumeFile::Channel> channels = grid.getVolumeChannels();
+		buffer->names.resize(channels.size());
+		buffer->fields.resize(channels.size());
+		for (size_t c = 0; c < channels.size(); c++) {
+			buffer->names[c] = channels[c].name;
+			buffer->fields[c] = *channels[c].grid;
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mPending.push_back(buffer);
+	}
+	mWorkReady.notify_one();
+}
+
+void CacheWriter::flush()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	mBufferFree.wait(lock, [this] { return mPending.empty() && mBusy == 0; });
+}
+
+void CacheWriter::run()
+{
+	for (;;) {
+		Frame* frame;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mWorkReady.wait(lock, [this] { return mStopping || !mPending.empty(); });
+			if (mPending.empty()) return; // Stopping and nothing left to write.
+			frame = mPending.front();
+			mPending.pop_front();
+			mBusy++;
+		}
+
+		std::string number = std::to_string(frame->number);
+		if (frame->formats & BGEO) {
+			writeDensity(frame->directory + "/DensityFrame" + number + ".bgeo", frame->density, frame->config, &frame->tiles);
+			writeParticles(frame->directory + "/frame" + number + ".bgeo", frame->particles);
+		}
+		if (frame->formats & VOLUME) {
+			std::vector<VolumeFile::Channel> channels;
+			for (size_t c = 0; c < frame->fields.size(); c++) channels.push_back(VolumeFile::Channel(frame->names[c], &frame->fields[c]));
+			VolumeFile::write(frame->directory + "/VolumeFrame" + number + ".vol", frame->config, channels);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mBusy--;
+			mFree.push_back(frame);
+		}
+		mBufferFree.notify_all();
+	}
+}
+
+void CacheWriter::writeDensity(const std::string& filename, const GridData& density, const SimConfig& config,
+                               const TileMask* tiles)
+{
+	// One particle per cell center, k slowest and i fastest. Cells of inactive
+	// tiles hold no smoke and are left out.
+	int numCells = 0;
+	for (int k = 0; k < config.dim[2]; k++)
+		for (int j = 0; j < config.dim[1]; j++)
+			for (int i = 0; i < config.dim[0]; i++)
+				if (!tiles || tiles->isActiveCell(i, j, k)) numCells++;
+
+	Partio::ParticlesDataMutable *density_field = Partio::create();
+	Partio::ParticleAttribute posH, rhoH;
+	posH = density_field->addAttribute("position", Partio::VECTOR, 3);
+	rhoH = density_field->addAttribute("density", Partio::VECTOR, 1);
+	density_field->addParticles(numCells);
+
+	int idx = 0;
+	for (int k = 0; k < config.dim[2]; k++)
+		for (int j = 0; j < config.dim[1]; j++)
+			for (int i = 0; i < config.dim[0]; i++) {
+				if (tiles && !tiles->isActiveCell(i, j, k)) continue;
+				float *p = density_field->dataWrite<float>(posH, idx);
+				float *rho = density_field->dataWrite<float>(rhoH, idx);
+				const double h = config.cellSize;
+				vec3 cellCenter(h/2.0 + i*h, h/2.0 + j*h, h/2.0 + k*h); // As MACGrid::getCenter()
+				for (int l = 0; l < 3; l++)
+				{
+					p[l] = cellCenter[l];
+				}
+				rho[0] = density.at(i, j, k); // The cell value, no need to interpolate at its center.
+				idx++;
+			}
+
+	Partio::write(filename.c_str(), *density_field);
+	density_field->release();
+}
+
+void CacheWriter::writeParticles(const std::string& filename, const ParticleSet& particles)
+{
+	Partio::ParticlesDataMutable *parts = Partio::create();
+	Partio::ParticleAttribute posH, vH;
+	posH = parts->addAttribute("position", Partio::VECTOR, 3);
+	vH = parts->addAttribute("v", Partio::VECTOR, 3);
+	parts->addParticles(particles.numAlive());
+
+	int idx = 0;
+	for (int i = 0; i < particles.size(); i++)
+	{
+		if (!particles.isAlive(i)) continue;
+		float *p = parts->dataWrite<float>(posH, idx);
+		float *v = parts->dataWrite<float>(vH, idx);
+		for (int k = 0; k < 3; k++)
+		{
+			p[k] = particles.positions(k)[i];
+			v[k] = particles.velocities(k)[i];
+		}
+		idx++;
+	}
+
+	Partio::write(filename.c_str(), *parts);
+	parts->release();
+}
@@ -0,0 +1,85 @@
+// Background writer for the per-frame caches.
+//
+// write() only snapshots the fields and rendering particles it needs into
+// one of a fixed set of reusable frame buffers and returns. Worker threads
+// build the Partio data and write the files, so I/O overlaps with simulating
+// the next frames. When every buffer is still waiting to be written, write()
+// blocks, which bounds both the queue and the memory used.
+//
+// Frames go out as .bgeo point clouds (BGEO), dense .vol volumes (VOLUME, see
+// volume_file.h) or both.
+
+#ifndef CACHE_WRITER_H
+#define CACHE_WRITER_H
+
+#include "grid_data.h"
+#include "particle_set.h"
+#include "tile_mask.h"
+#include "volume_file.h"
+#include "vec.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class MACGrid;
+
+class CacheWriter
+{
+public:
+	enum Format { BGEO = 1, VOLUME = 2 };
+
+	// numBuffers frames can be in flight at once (2 double buffers the output).
+	explicit CacheWriter(int numThreads = 1, int numBuffers = 2);
+	~CacheWriter(); // Writes everything still queued.
+
+	// Combination of Format flags, BGEO by default. Applies to later write() calls.
+	void setFormats(int formats) { mFormats = formats; }
+	int getFormats() const { return mFormats; }
+
+	// Queues directory/DensityFrame<frame>.bgeo and directory/frame<frame>.bgeo,
+	// and/or directory/VolumeFrame<frame>.vol, for the current state of grid.
+	void write(const MACGrid& grid, const std::string& directory, int frame);
+
+	// Blocks until every queued frame is on disk.
+	void flush();
+
+	// Synchronous writers, also used by the worker threads. Given tiles,
+	// writeDensity() leaves out the cells of inactive tiles; writeParticles()
+	// leaves out dead particles.
+	static void writeDensity(const std::string& filename, const GridData& density, const SimConfig& config,
+	                         const TileMask* tiles = 0);
+	static void writeParticles(const std::string& filename, const ParticleSet& particles);
+
+private:
+	struct Frame
+	{
+		std::string directory;
+		int number;
+		int formats;
+		SimConfig config;
+		GridData density;
+		TileMask tiles;
+		ParticleSet particles;
+		std::vector<const char*> names;  // Volume channels.
+		std::vector<GridData> fields;
+	};
+
+	void run();
+
+	int mFormats;
+	std::vector<Frame> mFrames;
+	std::vector<Frame*> mFree;     // Buffers ready to take a snapshot.
+	std::deque<Frame*> mPending;   // Snapshots waiting for a worker.
+	int mBusy;                     // Snapshots being written right now.
+	bool mStopping;
+
+	std::mutex mMutex;
+	std::condition_variable mWorkReady;
+	std::condition_variable mBufferFree;
+	std::vector<std::thread> mThreads;
+};
+
+#endif // CACHE_WRITER_H
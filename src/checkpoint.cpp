@@ -0,0 +1,121 @@
+#include "checkpoint.h"
+#include <stdio.h>
+
+void CheckpointWriter::writeBytes(const void* data, size_t size)
+{
+	const char* bytes = (const char*) data;
+	mBuffer.insert(mBuffer.end(), bytes, bytes + size);
+}
+
+void CheckpointWriter::writeGrid(const GridData& grid)
+{
+	// The padded storage as is, ghost entries included. The entry size tells
+	// double from SMOKE_FLOAT checkpoints.
+	const std::vector<Real>& data = grid.data();
+	write((uint32_t) sizeof(Real));
+	write((uint64_t) data.size());
+	writeBytes(&data[0], data.size() * sizeof(Real));
+}
+
+void CheckpointWriter::writeParticles(const ParticleSet& particles)
+{
+	// The arrays as is, dead particles included: positions x, y, z, then
+	// velocities x, y, z, then ages.
+	const size_t size = particles.size();
+	write((uint64_t) size);
+	for (int axis = 0; axis < 3; axis++) writeBytes(particles.positions(axis), size * sizeof(float));
+	for (int axis = 0; axis < 3; axis++) writeBytes(particles.velocities(axis), size * sizeof(float));
+	writeBytes(particles.ages(), size * sizeof(int));
+}
+
+void CheckpointWriter::writeSolids(const SolidMask& solids)
+{
+	// The cells as stored, the faces follow from them.
+	const std::vector<unsigned char>& cells = solids.cells();
+	write((uint64_t) cells.size());
+	writeBytes(&cells[0], cells.size());
+}
+
+bool CheckpointWriter::save(const std::string& filename) const
+{
+	std::string temporary = filename + ".tmp";
+	FILE* file = fopen(temporary.c_str(), "wb");
+	if (!file) return false;
+	bool ok = mBuffer.empty() || fwrite(&mBuffer[0], 1, mBuffer.size(), file) == mBuffer.size();
+	ok = fclose(file) == 0 && ok;
+#ifdef _WIN32
+	if (ok) remove(filename.c_str()); // rename() does not replace on Windows.
+#endif
+	if (ok) ok = rename(temporary.c_str(), filename.c_str()) == 0;
+	if (!ok) remove(temporary.c_str());
+	return ok;
+}
+
+bool CheckpointReader::load(const std::string& filename)
+{
+	mBuffer.clear();
+	mPos = 0;
+	mFailed = true;
+
+	FILE* file = fopen(filename.c_str(), "rb");
+	if (!file) return false;
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if (size > 0) {
+		mBuffer.resize(size);
+		mFailed = fread(&mBuffer[0], 1, size, file) != (size_t) size;
+	}
+	fclose(file);
+	return !mFailed;
+}
+
+bool CheckpointReader::readBytes(void* data, size_t size)
+{
+	if (mFailed || size > mBuffer.size() - mPos) {
+		mFailed = true;
+		return false;
+	}
+	memcpy(data, &mBuffer[mPos], size);
+	mPos += size;
+	return true;
+}
+
+bool CheckpointReader::readGrid(GridData& grid)
+{
+	std::vector<Real>& data = grid.data();
+	uint32_t entrySize = 0;
+	uint64_t size = 0;
+	if (!read(entrySize) || !read(size) || entrySize != sizeof(Real) || size != data.size()) {
+		mFailed = true;
+		return false;
+	}
+	return readBytes(&data[0], data.size() * sizeof(Real));
+}
+
+bool CheckpointReader::readParticles(ParticleSet& particles)
+{
+	uint64_t size = 0;
+	if (!read(size) || size > (mBuffer.size() - mPos) / (6 * sizeof(float) + sizeof(int))) {
+		mFailed = true;
+		return false;
+	}
+	particles.resize((int) size);
+	for (int axis = 0; axis < 3; axis++) readBytes(particles.positions(axis), size * sizeof(float));
+	for (int axis = 0; axis < 3; axis++) readBytes(particles.velocities(axis), size * sizeof(float));
+	readBytes(particles.ages(), size * sizeof(int));
+	return !mFailed;
+}
+
+bool CheckpointReader::readSolids(SolidMask& solids)
+{
+	std::vector<unsigned char>& cells = solids.cells();
+	uint64_t size = 0;
+	if (!read(size) || size != cells.size()) {
+		mFailed = true;
+		return false;
+	}
+	if (!readBytes(&cells[0], cells.size())) return false;
+	solids.update();
+	return true;
+}
@@ -0,0 +1,66 @@
+// Binary checkpoint files for restarting a simulation.
+//
+// CheckpointWriter serializes into a memory buffer that is kept between
+// checkpoints and lands on disk with a single write to a temporary file,
+// renamed over the target afterwards, so a crash mid-write never leaves a
+// truncated checkpoint behind. CheckpointReader loads a whole file and reads
+// it back in the same order; any read past the end marks it failed.
+//
+// Values are stored in native byte order, checkpoints are meant to be
+// restarted on the machine type that wrote them.
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "grid_data.h"
+#include "particle_set.h"
+#include "solid_mask.h"
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+class CheckpointWriter
+{
+public:
+	// Starts a new checkpoint, keeping the buffer's memory.
+	void clear() { mBuffer.clear(); }
+
+	template <class T> void write(const T& value) { writeBytes(&value, sizeof(T)); }
+	void writeGrid(const GridData& grid);
+	void writeParticles(const ParticleSet& particles);
+	void writeSolids(const SolidMask& solids);
+
+	// Returns false if the file could not be written.
+	bool save(const std::string& filename) const;
+
+private:
+	void writeBytes(const void* data, size_t size);
+	std::vector<char> mBuffer;
+};
+
+class CheckpointReader
+{
+public:
+	CheckpointReader() : mPos(0), mFailed(false) {}
+
+	// Returns false if the file could not be read.
+	bool load(const std::string& filename);
+
+	template <class T> bool read(T& value) { return readBytes(&value, sizeof(T)); }
+	// grid must already have the size and entry type stored in the checkpoint.
+	bool readGrid(GridData& grid);
+	bool readParticles(ParticleSet& particles);
+	// solids must already have the size stored in the checkpoint; updates it.
+	bool readSolids(SolidMask& solids);
+
+	bool failed() const { return mFailed; }
+
+private:
+	bool readBytes(void* data, size_t size);
+	std::vector<char> mBuffer;
+	size_t mPos;
+	bool mFailed;
+};
+
+#endif // CHECKPOINT_H
@@ -18,4 +18,32 @@ const double theBuoyancyAlpha = 0.08; // Gravity's effect on the smoke particles
 const double theBuoyancyBeta = 0.37; // Buoyancy's effect due to temperature difference.	
 const double theBuoyancyAmbientTemperature = 0.0; // Ambient temperature.
 
-const double theVorticityEpsilon = 0.10; // default value is 0.10
\ No newline at end of file
+const double theVorticityEpsilon = 0.10; // default value is 0.10
+
+const int theParticleCapacity = 1 << 20;
+const int theParticleMaxAge = 0; // Frames, 0 keeps particles until they leave the smoke.
+const double theParticleMinDensity = 0.0; // Retires particles in cells without smoke.
+const int theParticleCompactInterval = 10; // Frames.
+
+
+SimConfig::SimConfig() :
+	cellSize(theCellSize),
+	airDensity(theAirDensity),
+	buoyancyAlpha(theBuoyancyAlpha),
+	buoyancyBeta(theBuoyancyBeta),
+	buoyancyAmbientTemperature(theBuoyancyAmbientTemperature),
+	vorticityEpsilon(theVorticityEpsilon),
+	particleCapacity(theParticleCapacity),
+	particleMaxAge(theParticleMaxAge),
+	particleMinDensity(theParticleMinDensity),
+	particleCompactInterval(theParticleCompactInterval)
+{
+	setDimensions(theDim[0], theDim[1], theDim[2]);
+}
+
+void SimConfig::setDimensions(int x, int y, int z)
+{
+	dim[0] = x;
+	dim[1] = y;
+	dim[2] = z;
+}
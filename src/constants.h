@@ -9,6 +9,7 @@
 
 
 
+// Default simulation configuration, see SimConfig below.
 // Don't modify the values of these here.
 // Modify the values of these in Constants.cpp instead.
 extern const int theMillisecondsPerFrame;
@@ -19,6 +20,41 @@ extern const double theBuoyancyAlpha;
 extern const double theBuoyancyBeta;	
 extern const double theBuoyancyAmbientTemperature;
 extern const double theVorticityEpsilon;
+extern const int theParticleCapacity;
+extern const int theParticleMaxAge;
+extern const double theParticleMinDensity;
+extern const int theParticleCompactInterval;
+
+
+// Grid size and physical constants of one simulation. Every MACGrid and
+// GridData carries its own copy, so one binary can run any resolution and
+// several simulations of different sizes can live in one process.
+// Default constructed, it holds the values of the constants above.
+struct SimConfig
+{
+	SimConfig();
+
+	// Sets the number of cells along X, Y and Z.
+	void setDimensions(int x, int y, int z);
+
+	int dim[3];        // Number of cells in each X,Y,Z direction.
+	double cellSize;   // Size of each cell.
+	double airDensity;
+	double buoyancyAlpha;  // Gravity's effect on the smoke particles.
+	double buoyancyBeta;   // Buoyancy's effect due to temperature difference.
+	double buoyancyAmbientTemperature;
+	double vorticityEpsilon;
+
+	// Rendering particles, see ParticleSet. Emission stops at particleCapacity
+	// live particles. A particle retires once it is older than particleMaxAge
+	// frames (0: never) or the density of its cell is at most
+	// particleMinDensity (< 0: never). Dead particles are dropped every
+	// particleCompactInterval frames, and whenever emission finds the pool full.
+	int particleCapacity;
+	int particleMaxAge;
+	double particleMinDensity;
+	int particleCompactInterval;
+};
 
 
 
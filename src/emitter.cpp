@@ -0,0 +1,119 @@
+#include "emitter.h"
+#include <algorithm>
+#include <fstream>
+#include <math.h>
+#include <sstream>
+
+Emitter::Emitter() :
+	shape(BOX),
+	lo(0.0, 0.0, 0.0),
+	hi(0.0, 0.0, 0.0),
+	center(0.0, 0.0, 0.0),
+	radius(0.0),
+	velocity(0.0, 0.0, 0.0),
+	density(1.0),
+	temperature(1.0),
+	particlesPerCell(10),
+	firstFrame(0),
+	lastFrame(100)
+{
+}
+
+Emitter Emitter::box(const vec3& lo, const vec3& hi)
+{
+	Emitter e;
+	e.shape = BOX;
+	e.lo = lo;
+	e.hi = hi;
+	return e;
+}
+
+Emitter Emitter::sphere(const vec3& center, double radius)
+{
+	Emitter e;
+	e.shape = SPHERE;
+	e.center = center;
+	e.radius = radius;
+	e.lo = center - vec3(radius, radius, radius);
+	e.hi = center + vec3(radius, radius, radius);
+	return e;
+}
+
+bool Emitter::contains(const vec3& pt) const
+{
+	if (shape == SPHERE) return (pt - center).SqrLength() <= radius * radius;
+	return pt[0] >= lo[0] && pt[0] < hi[0] && pt[1] >= lo[1] && pt[1] < hi[1] && pt[2] >= lo[2] && pt[2] < hi[2];
+}
+
+void Emitter::cellBounds(const SimConfig& config, int cellLo[3], int cellHi[3]) const
+{
+	// Cell i is centered at (i + 0.5) * cellSize.
+	for (int axis = 0; axis < 3; axis++) {
+		cellLo[axis] = std::max((int) floor(lo[axis] / config.cellSize - 0.5), 0);
+		cellHi[axis] = std::min((int) ceil(hi[axis] / config.cellSize - 0.5) + 1, config.dim[axis]);
+	}
+}
+
+bool Emitter::load(const std::string& filename, std::vector<Emitter>& emitters, std::string& error)
+{
+	std::ifstream file(filename.c_str());
+	if (!file) {
+		error = "cannot open " + filename;
+		return false;
+	}
+
+	std::vector<Emitter> loaded;
+	std::string line;
+	for (int number = 1; std::getline(file, line); number++) {
+		line = line.substr(0, line.find('#'));
+		std::istringstream in(line);
+		std::string word;
+		if (!(in >> word)) continue;
+
+		std::ostringstream where;
+		where << filename << ":" << number << ": ";
+		Emitter e;
+		if (word == "box") {
+			vec3 lo, hi;
+			if (!(in >> lo[0] >> lo[1] >> lo[2] >> hi[0] >> hi[1] >> hi[2])) {
+				error = where.str() + "box needs two corners";
+				return false;
+			}
+			e = box(lo, hi);
+		}
+		else if (word == "sphere") {
+			vec3 center;
+			double radius;
+			if (!(in >> center[0] >> center[1] >> center[2] >> radius)) {
+				error = where.str() + "sphere needs a center and a radius";
+				return false;
+			}
+			e = sphere(center, radius);
+		}
+		else {
+			error = where.str() + "unknown emitter '" + word + "'";
+			return false;
+		}
+
+		while (in >> word) {
+			bool ok;
+			if (word == "velocity") ok = (bool) (in >> e.velocity[0] >> e.velocity[1] >> e.velocity[2]);
+			else if (word == "density") ok = (bool) (in >> e.density);
+			else if (word == "temperature") ok = (bool) (in >> e.temperature);
+			else if (word == "particles") ok = (bool) (in >> e.particlesPerCell);
+			else if (word == "frames") ok = (bool) (in >> e.firstFrame >> e.lastFrame);
+			else {
+				error = where.str() + "unknown option '" + word + "'";
+				return false;
+			}
+			if (!ok) {
+				error = where.str() + "missing value for '" + word + "'";
+				return false;
+			}
+		}
+		loaded.push_back(e);
+	}
+
+	emitters.swap(loaded);
+	return true;
+}
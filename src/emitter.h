@@ -0,0 +1,60 @@
+// Smoke sources.
+//
+// An Emitter is a box or a sphere in world space. On every frame of
+// [firstFrame, lastFrame) it fills the cells whose centers it contains:
+// their density and temperature are set, the nonzero components of velocity
+// go onto the upper faces of each cell (U at i+1, V at j+1, W at k+1), and
+// every cell gains particlesPerCell rendering particles. Only the cells of
+// the emitter's bounds are visited, so an emitter costs in proportion to its
+// size, not to that of the grid.
+//
+// Scene files list one emitter per line, '#' starts a comment:
+//
+//   box <x0> <y0> <z0> <x1> <y1> <z1> [options]
+//   sphere <x> <y> <z> <radius> [options]
+//
+// followed by any of these options, defaults in brackets:
+//
+//   velocity <x> <y> <z>    [0 0 0]
+//   density <d>             [1]
+//   temperature <t>         [1]
+//   particles <n>           per cell and frame [10]
+//   frames <first> <last>   [0 100]
+
+#ifndef EMITTER_H
+#define EMITTER_H
+
+#include "constants.h"
+#include "vec.h"
+#include <string>
+#include <vector>
+
+struct Emitter
+{
+	enum Shape { BOX, SPHERE };
+
+	Emitter();
+	static Emitter box(const vec3& lo, const vec3& hi);
+	static Emitter sphere(const vec3& center, double radius);
+
+	bool isActive(int frame) const { return frame >= firstFrame && frame < lastFrame; }
+	bool contains(const vec3& pt) const;
+	// The cells [lo, hi) of config whose centers may lie inside, clamped to the grid.
+	void cellBounds(const SimConfig& config, int lo[3], int hi[3]) const;
+
+	Shape shape;
+	vec3 lo, hi;        // Bounds, the box itself for BOX.
+	vec3 center;        // SPHERE only.
+	double radius;      // SPHERE only.
+	vec3 velocity;
+	double density;
+	double temperature;
+	int particlesPerCell;
+	int firstFrame, lastFrame;
+
+	// Reads the emitters of a scene file. On failure returns false and
+	// describes the first problem, with its line, in error.
+	static bool load(const std::string& filename, std::vector<Emitter>& emitters, std::string& error);
+};
+
+#endif // EMITTER_H
@@ -1,105 +1,233 @@
 #include "grid_data.h"
+#include <algorithm>
+
+// Vectorized stencil evaluation: AVX(-512) lanes of double, or SSE/AVX lanes
+// of float in SMOKE_FLOAT builds. Other targets use the scalar loop.
+#if defined(SMOKE_FLOAT) && (defined(__SSE2__) || defined(_M_X64))
+#define SIMD_STENCIL_FLOAT
+#elif !defined(SMOKE_FLOAT) && defined(__AVX__)
+#define SIMD_STENCIL_DOUBLE
+#endif
 
+#if defined(SIMD_STENCIL_FLOAT) || defined(SIMD_STENCIL_DOUBLE)
+#include <immintrin.h>
+#endif
 
-GridData::GridData() :
-   mDfltValue(0.0), mMax(0.0,0.0,0.0)
-{
-}
+#if defined(SIMD_STENCIL_DOUBLE)
+namespace {
 
-GridData::GridData(const GridData& orig) :
-   mDfltValue(orig.mDfltValue)
-{
-   mData = orig.mData;
-   mMax = orig.mMax;
-}
+   // Lane-wise GridData::CINT: the same operations in the same order, so
+   // every lane matches the scalar result. x, xx and xxx hold the
+   // broadcast fraction and its square and cube.
+   inline __m256d cint4(__m256d q0, __m256d q1, __m256d q2, __m256d q3, __m256d x, __m256d xx, __m256d xxx)
+   {
+      const __m256d zero = _mm256_setzero_pd();
+      const __m256d half = _mm256_set1_pd(0.5);
+      __m256d d_i = _mm256_mul_pd(_mm256_sub_pd(q2, q0), half);
+      __m256d d_i_plus_1 = _mm256_mul_pd(_mm256_sub_pd(q3, q1), half);
+      __m256d delta_q = _mm256_sub_pd(q2, q1);
+
+      // Zero the slopes whose sign disagrees with delta_q.
+      __m256d up = _mm256_cmp_pd(delta_q, zero, _CMP_GT_OQ);
+      __m256d down = _mm256_cmp_pd(delta_q, zero, _CMP_LT_OQ);
+      d_i = _mm256_andnot_pd(_mm256_or_pd(_mm256_and_pd(up, _mm256_cmp_pd(d_i, zero, _CMP_LT_OQ)),
+                                          _mm256_and_pd(down, _mm256_cmp_pd(d_i, zero, _CMP_GT_OQ))), d_i);
+      d_i_plus_1 = _mm256_andnot_pd(_mm256_or_pd(_mm256_and_pd(up, _mm256_cmp_pd(d_i_plus_1, zero, _CMP_LT_OQ)),
+                                                 _mm256_and_pd(down, _mm256_cmp_pd(d_i_plus_1, zero, _CMP_GT_OQ))), d_i_plus_1);
+
+      __m256d a = _mm256_sub_pd(_mm256_sub_pd(_mm256_mul_pd(_mm256_set1_pd(3.0), delta_q), _mm256_mul_pd(_mm256_set1_pd(2.0), d_i)), d_i_plus_1);
+      __m256d b = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(-2.0), delta_q), d_i), d_i_plus_1);
+      __m256d q_x = _mm256_add_pd(q1, _mm256_mul_pd(d_i, x));
+      q_x = _mm256_add_pd(q_x, _mm256_mul_pd(a, xx));
+      return _mm256_add_pd(q_x, _mm256_mul_pd(b, xxx));
+   }
 
-GridData::~GridData() 
-{
-}
+#if defined(__AVX512F__)
+   inline __m512d cint8(__m512d q0, __m512d q1, __m512d q2, __m512d q3, __m512d x, __m512d xx, __m512d xxx)
+   {
+      const __m512d zero = _mm512_setzero_pd();
+      const __m512d half = _mm512_set1_pd(0.5);
+      __m512d d_i = _mm512_mul_pd(_mm512_sub_pd(q2, q0), half);
+      __m512d d_i_plus_1 = _mm512_mul_pd(_mm512_sub_pd(q3, q1), half);
+      __m512d delta_q = _mm512_sub_pd(q2, q1);
+
+      __mmask8 up = _mm512_cmp_pd_mask(delta_q, zero, _CMP_GT_OQ);
+      __mmask8 down = _mm512_cmp_pd_mask(delta_q, zero, _CMP_LT_OQ);
+      d_i = _mm512_mask_mov_pd(d_i, (up & _mm512_cmp_pd_mask(d_i, zero, _CMP_LT_OQ)) |
+                                    (down & _mm512_cmp_pd_mask(d_i, zero, _CMP_GT_OQ)), zero);
+      d_i_plus_1 = _mm512_mask_mov_pd(d_i_plus_1, (up & _mm512_cmp_pd_mask(d_i_plus_1, zero, _CMP_LT_OQ)) |
+                                                  (down & _mm512_cmp_pd_mask(d_i_plus_1, zero, _CMP_GT_OQ)), zero);
+
+      __m512d a = _mm512_sub_pd(_mm512_sub_pd(_mm512_mul_pd(_mm512_set1_pd(3.0), delta_q), _mm512_mul_pd(_mm512_set1_pd(2.0), d_i)), d_i_plus_1);
+      __m512d b = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(_mm512_set1_pd(-2.0), delta_q), d_i), d_i_plus_1);
+      __m512d q_x = _mm512_add_pd(q1, _mm512_mul_pd(d_i, x));
+      q_x = _mm512_add_pd(q_x, _mm512_mul_pd(a, xx));
+      return _mm512_add_pd(q_x, _mm512_mul_pd(b, xxx));
+   }
+
+   // Two rows in one vector and back. The plain casts, inserts and extracts
+   // fill the other lanes from _mm*_undefined_pd(), which GCC 12 reports as
+   // used uninitialized; the masked forms take those lanes from zero.
+   inline __m512d combine(__m256d low, __m256d high)
+   {
+      const __m512d zero = _mm512_setzero_pd();
+      __m512d rows = _mm512_mask_insertf64x4(zero, 0xFF, zero, low, 0);
+      return _mm512_mask_insertf64x4(rows, 0xFF, rows, high, 1);
+   }
+
+   inline __m256d half(__m512d rows, int h)
+   {
+      return h == 0 ? _mm512_mask_extractf64x4_pd(_mm256_setzero_pd(), 0x0F, rows, 0)
+                    : _mm512_mask_extractf64x4_pd(_mm256_setzero_pd(), 0x0F, rows, 1);
+   }
+#endif
+
+   // The 4 stencil entries along x of one row. They are adjacent in storage
+   // unless a clamped x axis repeated an entry at the border.
+   inline __m256d loadRow(const double* row, const int offX[4], bool contiguous)
+   {
+      if (contiguous) return _mm256_loadu_pd(row + offX[0]);
+      return _mm256_set_pd(row[offX[3]], row[offX[2]], row[offX[1]], row[offX[0]]);
+   }
 
-std::vector<double>& GridData::data()
-{
-   return mData;
 }
+#endif
 
-GridData& GridData::operator=(const GridData& orig)
-{
-   if (this == &orig)
+#if defined(SIMD_STENCIL_FLOAT)
+namespace {
+
+   // The float counterparts of the helpers above.
+   inline __m128 cint4(__m128 q0, __m128 q1, __m128 q2, __m128 q3, __m128 x, __m128 xx, __m128 xxx)
+   {
+      const __m128 zero = _mm_setzero_ps();
+      const __m128 half = _mm_set1_ps(0.5f);
+      __m128 d_i = _mm_mul_ps(_mm_sub_ps(q2, q0), half);
+      __m128 d_i_plus_1 = _mm_mul_ps(_mm_sub_ps(q3, q1), half);
+      __m128 delta_q = _mm_sub_ps(q2, q1);
+
+      __m128 up = _mm_cmpgt_ps(delta_q, zero);
+      __m128 down = _mm_cmplt_ps(delta_q, zero);
+      d_i = _mm_andnot_ps(_mm_or_ps(_mm_and_ps(up, _mm_cmplt_ps(d_i, zero)),
+                                    _mm_and_ps(down, _mm_cmpgt_ps(d_i, zero))), d_i);
+      d_i_plus_1 = _mm_andnot_ps(_mm_or_ps(_mm_and_ps(up, _mm_cmplt_ps(d_i_plus_1, zero)),
+                                           _mm_and_ps(down, _mm_cmpgt_ps(d_i_plus_1, zero))), d_i_plus_1);
+
+      __m128 a = _mm_sub_ps(_mm_sub_ps(_mm_mul_ps(_mm_set1_ps(3.0f), delta_q), _mm_mul_ps(_mm_set1_ps(2.0f), d_i)), d_i_plus_1);
+      __m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(-2.0f), delta_q), d_i), d_i_plus_1);
+      __m128 q_x = _mm_add_ps(q1, _mm_mul_ps(d_i, x));
+      q_x = _mm_add_ps(q_x, _mm_mul_ps(a, xx));
+      return _mm_add_ps(q_x, _mm_mul_ps(b, xxx));
+   }
+
+#if defined(__AVX__)
+   inline __m256 cint8(__m256 q0, __m256 q1, __m256 q2, __m256 q3, __m256 x, __m256 xx, __m256 xxx)
+   {
+      const __m256 zero = _mm256_setzero_ps();
+      const __m256 half = _mm256_set1_ps(0.5f);
+      __m256 d_i = _mm256_mul_ps(_mm256_sub_ps(q2, q0), half);
+      __m256 d_i_plus_1 = _mm256_mul_ps(_mm256_sub_ps(q3, q1), half);
+      __m256 delta_q = _mm256_sub_ps(q2, q1);
+
+      __m256 up = _mm256_cmp_ps(delta_q, zero, _CMP_GT_OQ);
+      __m256 down = _mm256_cmp_ps(delta_q, zero, _CMP_LT_OQ);
+      d_i = _mm256_andnot_ps(_mm256_or_ps(_mm256_and_ps(up, _mm256_cmp_ps(d_i, zero, _CMP_LT_OQ)),
+                                          _mm256_and_ps(down, _mm256_cmp_ps(d_i, zero, _CMP_GT_OQ))), d_i);
+      d_i_plus_1 = _mm256_andnot_ps(_mm256_or_ps(_mm256_and_ps(up, _mm256_cmp_ps(d_i_plus_1, zero, _CMP_LT_OQ)),
+                                                 _mm256_and_ps(down, _mm256_cmp_ps(d_i_plus_1, zero, _CMP_GT_OQ))), d_i_plus_1);
+
+      __m256 a = _mm256_sub_ps(_mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(3.0f), delta_q), _mm256_mul_ps(_mm256_set1_ps(2.0f), d_i)), d_i_plus_1);
+      __m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(-2.0f), delta_q), d_i), d_i_plus_1);
+      __m256 q_x = _mm256_add_ps(q1, _mm256_mul_ps(d_i, x));
+      q_x = _mm256_add_ps(q_x, _mm256_mul_ps(a, xx));
+      return _mm256_add_ps(q_x, _mm256_mul_ps(b, xxx));
+   }
+#endif
+
+   inline __m128 loadRow(const float* row, const int offX[4], bool contiguous)
    {
-      return *this;
+      if (contiguous) return _mm_loadu_ps(row + offX[0]);
+      return _mm_set_ps(row[offX[3]], row[offX[2]], row[offX[1]], row[offX[0]]);
    }
-   mDfltValue = orig.mDfltValue;
-   mData = orig.mData;
-   mMax = orig.mMax;
-   return *this;
+
 }
+#endif
+
 
-void GridData::initialize(double dfltValue)
+GridData::GridData() :
+   mFaceAxis(-1), mStrideJ(0), mStrideK(0), mOrigin(0),
+   mCellSize(0.0), mDfltValue(0.0), mMax(0.0,0.0,0.0)
 {
-   mDfltValue = dfltValue;
-   mMax[0] = theCellSize*theDim[0];
-   mMax[1] = theCellSize*theDim[1];
-   mMax[2] = theCellSize*theDim[2];
-   mData.resize(theDim[0]*theDim[1]*theDim[2], false);
-   std::fill(mData.begin(), mData.end(), mDfltValue);
+   mDim[0] = mDim[1] = mDim[2] = 0;
 }
 
-double& GridData::operator()(int i, int j, int k)
+GridData::GridData(int faceAxis) :
+   mFaceAxis(faceAxis), mStrideJ(0), mStrideK(0), mOrigin(0),
+   mCellSize(0.0), mDfltValue(0.0), mMax(0.0,0.0,0.0)
 {
-   static double dflt = 0;
-   dflt = mDfltValue;  // HACK: Protect against setting the default value
-
-   if (i< 0 || j<0 || k<0 || 
-       i > theDim[0]-1 || 
-       j > theDim[1]-1 || 
-       k > theDim[2]-1) return dflt;
-
-   int col = i;
-   int row = k*theDim[0];
-   int stack = j*theDim[0]*theDim[2];
+   mDim[0] = mDim[1] = mDim[2] = 0;
+}
 
-   return mData[col+row+stack];
+std::vector<Real>& GridData::data()
+{
+   return mData;
 }
 
-const double GridData::operator()(int i, int j, int k) const
+void GridData::swap(GridData& other)
 {
-   static double dflt = 0;
-   dflt = mDfltValue;  // HACK: Protect against setting the default value
+   std::swap(mFaceAxis, other.mFaceAxis);
+   for (int axis = 0; axis < 3; axis++) std::swap(mDim[axis], other.mDim[axis]);
+   std::swap(mStrideJ, other.mStrideJ);
+   std::swap(mStrideK, other.mStrideK);
+   std::swap(mOrigin, other.mOrigin);
+   std::swap(mCellSize, other.mCellSize);
+   std::swap(mDfltValue, other.mDfltValue);
+   std::swap(mMax, other.mMax);
+   mData.swap(other.mData);
+}
 
-   if (i< 0 || j<0 || k<0 || 
-       i > theDim[0]-1 || 
-       j > theDim[1]-1 || 
-       k > theDim[2]-1) return dflt;
+void GridData::initialize(const SimConfig& config, double dfltValue)
+{
+   mDfltValue = dfltValue;
+   mCellSize = config.cellSize;
+   for (int axis = 0; axis < 3; axis++)
+   {
+      mDim[axis] = config.dim[axis] + (axis == mFaceAxis ? 1 : 0);
+      mMax[axis] = mCellSize*mDim[axis];
+   }
 
-   int col = i;
-   int row = k*theDim[0];
-   int stack = j*theDim[0]*theDim[2];
+   int paddedI = mDim[0] + GHOST_LO + GHOST_HI;
+   int paddedJ = mDim[1] + GHOST_LO + GHOST_HI;
+   int paddedK = mDim[2] + GHOST_LO + GHOST_HI;
+   mStrideK = paddedI;
+   mStrideJ = paddedI*paddedK;
+   mOrigin = GHOST_LO*(1 + mStrideK + mStrideJ);
 
-   return mData[col+row+stack];
+   mData.resize(paddedI*paddedJ*paddedK);
+   std::fill(mData.begin(), mData.end(), mDfltValue);
 }
 
-void GridData::getCell(const vec3& pt, int& i, int& j, int& k)
+void GridData::getCell(const vec3& pt, int& i, int& j, int& k) const
 {
    vec3 pos = worldToSelf(pt); 
-   i = (int) (pos[0]/theCellSize);
-   j = (int) (pos[1]/theCellSize);
-   k = (int) (pos[2]/theCellSize);   
+   i = (int) (pos[0]/mCellSize);
+   j = (int) (pos[1]/mCellSize);
+   k = (int) (pos[2]/mCellSize);   
 }
 
-double GridData::interpolate(const vec3& pt)
+double GridData::interpolate(const vec3& pt) const
 {
 	/*
 	// LINEAR INTERPOLATION:
    vec3 pos = worldToSelf(pt);
 
-   int i = (int) (pos[0]/theCellSize);
-   int j = (int) (pos[1]/theCellSize);
-   int k = (int) (pos[2]/theCellSize);
+   int i = (int) (pos[0]/mCellSize);
+   int j = (int) (pos[1]/mCellSize);
+   int k = (int) (pos[2]/mCellSize);
 
-   double scale = 1.0/theCellSize;  
-   double fractx = scale*(pos[0] - i*theCellSize);
-   double fracty = scale*(pos[1] - j*theCellSize);
-   double fractz = scale*(pos[2] - k*theCellSize);
+   double scale = 1.0/mCellSize;  
+   double fractx = scale*(pos[0] - i*mCellSize);
+   double fracty = scale*(pos[1] - j*mCellSize);
+   double fractz = scale*(pos[2] - k*mCellSize);
 
    assert (fractx < 1.0 && fractx >= 0);
    assert (fracty < 1.0 && fracty >= 0);
@@ -141,42 +269,9 @@ double GridData::interpolate(const vec3& pt)
 
 	
 	// SHARPER CUBIC INTERPOLATION:
-   vec3 pos = worldToSelf(pt);
-
-   int i = (int) (pos[0]/theCellSize);
-   int j = (int) (pos[1]/theCellSize);
-   int k = (int) (pos[2]/theCellSize);
-
-   double scale = 1.0/theCellSize;  
-   double fractx = scale*(pos[0] - i*theCellSize);
-   double fracty = scale*(pos[1] - j*theCellSize);
-   double fractz = scale*(pos[2] - k*theCellSize);
-
-#ifdef _DEBUG
-   assert (fractx < 1.0 && fractx >= 0);
-   assert (fracty < 1.0 && fracty >= 0);
-   assert (fractz < 1.0 && fractz >= 0);
-#endif
-
-  
-
-   double t[4][4];
-   double u[4];
-   double f;
-#define ONE 1
-#define EVAL(a,b,c) (*this)(a,b,c)
-	for (int x = -1; x <= 2; x++) {
-		for (int y = -1; y <= 2; y++) {
-			t[x+ONE][y+ONE] = CINT( EVAL(i+x,j+y,k-1), EVAL(i+x,j+y,k+0), EVAL(i+x,j+y,k+1), EVAL(i+x,j+y,k+2), fractz );
-		}
-	}
-#undef EVAL
-	for (int x = -1; x <= 2; x++) {
-		u[x+ONE] = CINT( t[x+ONE][-1+ONE], t[x+ONE][0+ONE], t[x+ONE][1+ONE], t[x+ONE][2+ONE], fracty );
-	}
-	f = CINT( u[-1+ONE], u[0+ONE], u[1+ONE], u[2+ONE], fractx );
-#undef ONE
-	return f;
+   Stencil s;
+   getStencil(pt, s);
+   return evaluate(s);
    
    /*
    // Y @ low Z:
@@ -267,228 +362,173 @@ double GridData::interpolate(const vec3& pt)
 }
 
 
-double GridData::CINT(double q_i_minus_1, double q_i, double q_i_plus_1, double q_i_plus_2, double x) const {
-
-	// The slopes:
-	double d_i = (q_i_plus_1 - q_i_minus_1) / 2.0;
-	double d_i_plus_1 = (q_i_plus_2 - q_i) / 2.0;
-
-	// Delta q:
-	double delta_q = q_i_plus_1 - q_i;
-
-	// Restrict the slopes:
-	if (delta_q > 0) {
-		if (d_i < 0) d_i = 0;
-		if (d_i_plus_1 < 0) d_i_plus_1 = 0;
-	} else if (delta_q < 0) {
-		if (d_i > 0) d_i = 0;
-		if (d_i_plus_1 > 0) d_i_plus_1 = 0;
-	}
-
-	// The Hermite cubic:
-	double q_x = q_i + d_i * x + (3.0 * delta_q - 2.0 * d_i - d_i_plus_1) * (x * x) + (-2.0 * delta_q + d_i + d_i_plus_1) * (x * x * x);
-
-	// Done:
-	return q_x;
-
-}
-
-vec3 GridData::worldToSelf(const vec3& pt) const
+void GridData::getStencil(const vec3& pt, Stencil& s) const
 {
-   vec3 out;
-   out[0] = min(max(0.0, pt[0] - theCellSize*0.5), mMax[0]);
-   out[1] = min(max(0.0, pt[1] - theCellSize*0.5), mMax[1]);
-   out[2] = min(max(0.0, pt[2] - theCellSize*0.5), mMax[2]);
-   return out;
-}
-
-GridDataX::GridDataX() : GridData()
-{
-}
-
-GridDataX::~GridDataX()
-{
-}
-
-void GridDataX::initialize(double dfltValue)
-{
-   GridData::initialize(dfltValue);
-   mMax[0] = theCellSize*(theDim[0]+1);
-   mMax[1] = theCellSize*theDim[1];
-   mMax[2] = theCellSize*theDim[2];
-   mData.resize((theDim[0]+1)*theDim[1]*theDim[2], false);
-   std::fill(mData.begin(), mData.end(), mDfltValue);
-}
-
-double& GridDataX::operator()(int i, int j, int k)
-{
-   static double dflt = 0;
-   dflt = mDfltValue;  // Protect against setting the default value
-
-   if (i < 0 || i > theDim[0]) return dflt;
-
-   if (j < 0) j = 0;
-   if (j > theDim[1]-1) j = theDim[1]-1;
-   if (k < 0) k = 0;
-   if (k > theDim[2]-1) k = theDim[2]-1;
-
-   int col = i;
-   int row = k*(theDim[0]+1);
-   int stack = j*(theDim[0]+1)*theDim[2];
-   return mData[stack + row + col];
-}
-
-const double GridDataX::operator()(int i, int j, int k) const
-{
-   static double dflt = 0;
-   dflt = mDfltValue;  // Protect against setting the default value
-
-   if (i < 0 || i > theDim[0]) return dflt;
+   vec3 pos = worldToSelf(pt);
 
-   if (j < 0) j = 0;
-   if (j > theDim[1]-1) j = theDim[1]-1;
-   if (k < 0) k = 0;
-   if (k > theDim[2]-1) k = theDim[2]-1;
+   int i = (int) (pos[0]/mCellSize);
+   int j = (int) (pos[1]/mCellSize);
+   int k = (int) (pos[2]/mCellSize);
 
-   int col = i;
-   int row = k*(theDim[0]+1);
-   int stack = j*(theDim[0]+1)*theDim[2];
-   return mData[stack + row + col];
-}
+   double scale = 1.0/mCellSize;  
+   s.fractx = scale*(pos[0] - i*mCellSize);
+   s.fracty = scale*(pos[1] - j*mCellSize);
+   s.fractz = scale*(pos[2] - k*mCellSize);
 
-vec3 GridDataX::worldToSelf(const vec3& pt) const
-{   
-   vec3 out;
-   out[0] = min(max(0.0, pt[0]), mMax[0]);
-   out[1] = min(max(0.0, pt[1]-theCellSize*0.5), mMax[1]);
-   out[2] = min(max(0.0, pt[2]-theCellSize*0.5), mMax[2]);
-   return out;
-}
-
-GridDataY::GridDataY() : GridData()
-{
-}
-
-GridDataY::~GridDataY()
-{
-}
+#ifdef _DEBUG
+   assert (s.fractx < 1.0 && s.fractx >= 0);
+   assert (s.fracty < 1.0 && s.fracty >= 0);
+   assert (s.fractz < 1.0 && s.fractz >= 0);
+#endif
 
-void GridDataY::initialize(double dfltValue)
-{
-   GridData::initialize(dfltValue);
-   mMax[0] = theCellSize*theDim[0];
-   mMax[1] = theCellSize*(theDim[1]+1);
-   mMax[2] = theCellSize*theDim[2];
-   mData.resize(theDim[0]*(theDim[1]+1)*theDim[2], false);
-   std::fill(mData.begin(), mData.end(), mDfltValue);
+   // Precompute the memory offsets of the 4 stencil slices along each axis.
+   // Clamped axes are resolved here once; everything else lands in the
+   // ghost layer, so the 64 reads in evaluate() need no bounds checks.
+   for (int o = -1; o <= 2; o++) {
+      int ii = i + o, jj = j + o, kk = k + o;
+      resolve(0, ii);
+      resolve(1, jj);
+      resolve(2, kk);
+      s.offX[o+1] = ii;
+      s.offY[o+1] = jj*mStrideJ;
+      s.offZ[o+1] = kk*mStrideK;
+   }
 }
 
-double& GridDataY::operator()(int i, int j, int k)
+double GridData::evaluate(const Stencil& s) const
 {
-   static double dflt = 0;
-   dflt = mDfltValue;  // Protect against setting the default value
-
-   if (j < 0 || j > theDim[1]) return dflt;
-
-   if (i < 0) i = 0;
-   if (i > theDim[0]-1) i = theDim[0]-1;
-   if (k < 0) k = 0;
-   if (k > theDim[2]-1) k = theDim[2]-1;
-
-   int col = i;
-   int row = k*theDim[0];
-   int stack = j*theDim[0]*theDim[2];
-   return mData[stack + row + col];
+   const Real* base = raw();
+   const int* offX = s.offX;
+   const int* offY = s.offY;
+   const int* offZ = s.offZ;
+   const double fractx = s.fractx, fracty = s.fracty, fractz = s.fractz;
+
+#if defined(SIMD_STENCIL_DOUBLE)
+   // x runs across the SIMD lanes: the 16 interpolations along z become one
+   // vector CINT per y row (two rows per vector with AVX-512), the 4 along y
+   // a single one, leaving one scalar CINT along x.
+   const bool contiguous = offX[3] - offX[0] == 3;
+   __m256d t[4];
+#if defined(__AVX512F__)
+   const __m512d zx = _mm512_set1_pd(fractz);
+   const __m512d zxx = _mm512_set1_pd(fractz * fractz);
+   const __m512d zxxx = _mm512_set1_pd(fractz * fractz * fractz);
+   for (int y = 0; y < 4; y += 2) {
+      __m512d q[4];
+      for (int z = 0; z < 4; z++) {
+         __m256d low = loadRow(base + offY[y] + offZ[z], offX, contiguous);
+         __m256d high = loadRow(base + offY[y+1] + offZ[z], offX, contiguous);
+         q[z] = combine(low, high);
+      }
+      __m512d rows = cint8(q[0], q[1], q[2], q[3], zx, zxx, zxxx);
+      t[y] = half(rows, 0);
+      t[y+1] = half(rows, 1);
+   }
+#else
+   const __m256d zx = _mm256_set1_pd(fractz);
+   const __m256d zxx = _mm256_set1_pd(fractz * fractz);
+   const __m256d zxxx = _mm256_set1_pd(fractz * fractz * fractz);
+   for (int y = 0; y < 4; y++) {
+      t[y] = cint4(loadRow(base + offY[y] + offZ[0], offX, contiguous),
+                   loadRow(base + offY[y] + offZ[1], offX, contiguous),
+                   loadRow(base + offY[y] + offZ[2], offX, contiguous),
+                   loadRow(base + offY[y] + offZ[3], offX, contiguous), zx, zxx, zxxx);
+   }
+#endif
+   double u[4];
+   _mm256_storeu_pd(u, cint4(t[0], t[1], t[2], t[3], _mm256_set1_pd(fracty),
+                             _mm256_set1_pd(fracty * fracty), _mm256_set1_pd(fracty * fracty * fracty)));
+   return CINT(u[0], u[1], u[2], u[3], fractx);
+#elif defined(SIMD_STENCIL_FLOAT)
+   // Same scheme in float lanes: AVX takes two y rows per vector, SSE one.
+   const bool contiguous = offX[3] - offX[0] == 3;
+   const float fz = (float) fractz, fy = (float) fracty;
+   __m128 t[4];
+#if defined(__AVX__)
+   const __m256 zx = _mm256_set1_ps(fz);
+   const __m256 zxx = _mm256_set1_ps(fz * fz);
+   const __m256 zxxx = _mm256_set1_ps(fz * fz * fz);
+   for (int y = 0; y < 4; y += 2) {
+      __m256 q[4];
+      for (int z = 0; z < 4; z++) {
+         __m128 low = loadRow(base + offY[y] + offZ[z], offX, contiguous);
+         __m128 high = loadRow(base + offY[y+1] + offZ[z], offX, contiguous);
+         q[z] = _mm256_insertf128_ps(_mm256_castps128_ps256(low), high, 1);
+      }
+      __m256 rows = cint8(q[0], q[1], q[2], q[3], zx, zxx, zxxx);
+      t[y] = _mm256_castps256_ps128(rows);
+      t[y+1] = _mm256_extractf128_ps(rows, 1);
+   }
+#else
+   const __m128 zx = _mm_set1_ps(fz);
+   const __m128 zxx = _mm_set1_ps(fz * fz);
+   const __m128 zxxx = _mm_set1_ps(fz * fz * fz);
+   for (int y = 0; y < 4; y++) {
+      t[y] = cint4(loadRow(base + offY[y] + offZ[0], offX, contiguous),
+                   loadRow(base + offY[y] + offZ[1], offX, contiguous),
+                   loadRow(base + offY[y] + offZ[2], offX, contiguous),
+                   loadRow(base + offY[y] + offZ[3], offX, contiguous), zx, zxx, zxxx);
+   }
+#endif
+   float u[4];
+   _mm_storeu_ps(u, cint4(t[0], t[1], t[2], t[3], _mm_set1_ps(fy), _mm_set1_ps(fy * fy), _mm_set1_ps(fy * fy * fy)));
+   return CINT(u[0], u[1], u[2], u[3], fractx);
+#else
+   double t[4][4];
+   double u[4];
+   double f;
+#define ONE 1
+#define EVAL(a,b,c) base[offX[a+ONE] + offY[b+ONE] + offZ[c+ONE]]
+	for (int x = -1; x <= 2; x++) {
+		for (int y = -1; y <= 2; y++) {
+			t[x+ONE][y+ONE] = CINT( EVAL(x,y,-1), EVAL(x,y,0), EVAL(x,y,1), EVAL(x,y,2), fractz );
+		}
+	}
+#undef EVAL
+	for (int x = -1; x <= 2; x++) {
+		u[x+ONE] = CINT( t[x+ONE][-1+ONE], t[x+ONE][0+ONE], t[x+ONE][1+ONE], t[x+ONE][2+ONE], fracty );
+	}
+	f = CINT( u[-1+ONE], u[0+ONE], u[1+ONE], u[2+ONE], fractx );
+#undef ONE
+	return f;
+#endif
 }
 
-const double GridDataY::operator()(int i, int j, int k) const
+void GridData::interpolate(const GridData* const grids[], int numGrids, const vec3 points[], int numPoints, double values[])
 {
-   static double dflt = 0;
-   dflt = mDfltValue;  // Protect against setting the default value
-
-   if (j < 0 || j > theDim[1]) return dflt;
-
-   if (i < 0) i = 0;
-   if (i > theDim[0]-1) i = theDim[0]-1;
-   if (k < 0) k = 0;
-   if (k > theDim[2]-1) k = theDim[2]-1;
-
-   int col = i;
-   int row = k*theDim[0];
-   int stack = j*theDim[0]*theDim[2];
-   return mData[stack + row + col];
+   // The stencil only depends on the layout, so it is shared by all grids.
+   Stencil s;
+   for (int p = 0; p < numPoints; p++) {
+      grids[0]->getStencil(points[p], s);
+      for (int g = 0; g < numGrids; g++) {
+#ifdef _DEBUG
+         assert (grids[g]->mFaceAxis == grids[0]->mFaceAxis && grids[g]->mStrideJ == grids[0]->mStrideJ &&
+                 grids[g]->mStrideK == grids[0]->mStrideK && grids[g]->mCellSize == grids[0]->mCellSize);
+#endif
+         values[p*numGrids + g] = grids[g]->evaluate(s);
+      }
+   }
 }
 
-vec3 GridDataY::worldToSelf(const vec3& pt) const
+vec3 GridData::worldToSelf(const vec3& pt) const
 {
    vec3 out;
-   out[0] = min(max(0.0, pt[0]-theCellSize*0.5), mMax[0]);
-   out[1] = min(max(0.0, pt[1]), mMax[1]);
-   out[2] = min(max(0.0, pt[2]-theCellSize*0.5), mMax[2]);
+   for (int axis = 0; axis < 3; axis++)
+   {
+      double shift = axis == mFaceAxis ? 0.0 : mCellSize*0.5;
+      out[axis] = min(max(0.0, pt[axis] - shift), mMax[axis]);
+   }
    return out;
 }
 
-GridDataZ::GridDataZ() : GridData()
-{
-}
-
-GridDataZ::~GridDataZ()
-{
-}
-
-void GridDataZ::initialize(double dfltValue)
-{
-   GridData::initialize(dfltValue);
-   mMax[0] = theCellSize*theDim[0];
-   mMax[1] = theCellSize*theDim[1];
-   mMax[2] = theCellSize*(theDim[2]+1);
-   mData.resize(theDim[0]*theDim[1]*(theDim[2]+1), false);
-   std::fill(mData.begin(), mData.end(), mDfltValue);
-}
-
-double& GridDataZ::operator()(int i, int j, int k)
+GridDataX::GridDataX() : GridData(0)
 {
-   static double dflt = 0;
-   dflt = mDfltValue;  // Protect against setting the default value
-
-   if (k < 0 || k > theDim[2]) return dflt;
-
-   if (i < 0) i = 0;
-   if (i > theDim[0]-1) i = theDim[0]-1;
-   if (j < 0) j = 0;
-   if (j > theDim[1]-1) j = theDim[1]-1;
-
-   int col = i;
-   int row = k*theDim[0];
-   int stack = j*theDim[0]*(theDim[2]+1);
-
-   return mData[stack + row + col];
 }
 
-const double GridDataZ::operator()(int i, int j, int k) const
+GridDataY::GridDataY() : GridData(1)
 {
-   static double dflt = 0;
-   dflt = mDfltValue;  // Protect against setting the default value
-
-   if (k < 0 || k > theDim[2]) return dflt;
-
-   if (i < 0) i = 0;
-   if (i > theDim[0]-1) i = theDim[0]-1;
-   if (j < 0) j = 0;
-   if (j > theDim[1]-1) j = theDim[1]-1;
-
-   int col = i;
-   int row = k*theDim[0];
-   int stack = j*theDim[0]*(theDim[2]+1);
-
-   return mData[stack + row + col];
 }
 
-vec3 GridDataZ::worldToSelf(const vec3& pt) const
+GridDataZ::GridDataZ() : GridData(2)
 {
-   vec3 out;
-   out[0] = min(max(0.0, pt[0]-theCellSize*0.5), mMax[0]);
-   out[1] = min(max(0.0, pt[1]-theCellSize*0.5), mMax[1]);
-   out[2] = min(max(0.0, pt[2]), mMax[2]);
-   return out;
 }
@@ -3,89 +3,198 @@
 #define GridData_H_
 
 #pragma warning(disable: 4244 4267 4996)
-#include <vector> 
+#include <assert.h>
+#include <vector>
 #include "vec.h"
-#include "constants.h" 
+#include "constants.h"
+#include "real.h"
 
 // GridData is capable of storing any data in a grid
 // Columns are indexed with i and increase with increasing x
 // Rows are indexed with j and increase with z
 // Stacks are indexed with k and increase with y
 //
-// GridData is initialized by global variables theDim and theCellSize
-// defined in GridData.cpp.  theDim defines the number of cells in 
-// each X,Y,Z direction.  theCellSize defines the size of each cell.
+// GridData is initialized from a SimConfig (see constants.h), whose dim
+// defines the number of cells in each X,Y,Z direction and cellSize the
+// size of each cell.
 // GridData's world space dimensions extend from (0,0,0) to mMax, where mMax is
-// (theCellSize*theDim[0], theCellSize*theDim[1], theCellSize*theDim[2])
+// (cellSize*dim[0], cellSize*dim[1], cellSize*dim[2])
+//
+// Storage is one flat array padded with GHOST_LO ghost entries below and
+// GHOST_HI above the valid range on every axis. Ghosts always hold the default
+// value, which covers every stencil interpolate() can touch, so hot loops can
+// read through at() or raw()/stride*() without any bounds checks.
+//
+// Entries are Real, see real.h; values go in and come out as double.
+//
+// GridDataX/Y/Z store face velocities. Along their face axis they behave like
+// GridData (default value outside), along the two other axes out of range
+// indices are clamped to the nearest valid entry.
 class GridData
 {
 public:
+   enum { GHOST_LO = 1, GHOST_HI = 3 };
+
    GridData();
-   GridData(const GridData& orig);
-   virtual ~GridData();
-   virtual GridData& operator=(const GridData& orig);
 
-   // Initialize underlying data structure with dlftValue
-   virtual void initialize(double dfltValue = 0.0);
+   // Initialize underlying data structure for the grid of config with dlftValue
+   void initialize(const SimConfig& config, double dfltValue = 0.0);
 
    // Returns editable data at index (i,j,k).
    // E.g. to set data on this object, call mygriddata(i,j,k) = newval
-   virtual double& operator()(int i, int j, int k);
-   virtual const double operator()(int i, int j, int k) const; 
+   // (i,j,k) must lie in the grid, after clamping along the tangential axes of
+   // GridDataX/Y/Z. Reads that may fall outside go through the const
+   // overload, which returns the default value there; e.g. read through a
+   // const GridData& to a grid that is being written.
+   inline Real& operator()(int i, int j, int k);
+   inline double operator()(int i, int j, int k) const;
+
+   // Unchecked access, valid for indices in [-GHOST_LO, dim(axis)-1+GHOST_HI].
+   inline Real& at(int i, int j, int k);
+   inline double at(int i, int j, int k) const;
 
    // Given a point in world coordinates, return the corresponding
    // value from this grid. mDfltValue is returned for points
-   // outside of our grid dimensions
-   virtual double interpolate(const vec3& pt);
-  
-   double CINT(double q_i_minus_1, double q_i, double q_i_plus_1, double q_i_plus_2, double x) const;
+   // outside of our grid dimensions. Only reads the grid, so it is
+   // safe to call from several threads at once.
+   double interpolate(const vec3& pt) const;
+
+   // Batched interpolate(): values[p*numGrids + g] = grids[g]->interpolate(points[p]).
+   // The grids must share one layout (same config and type), so the cell
+   // index and fractions of each point are worked out once for all of them.
+   static void interpolate(const GridData* const grids[], int numGrids, const vec3 points[], int numPoints, double values[]);
+
+   inline double CINT(double q_i_minus_1, double q_i, double q_i_plus_1, double q_i_plus_2, double x) const;
+
+   // Exchanges contents with other in O(1), other must be of the same type.
+   void swap(GridData& other);
 
-   // Access underlying data structure (for use with other UBLAS objects)
-   std::vector<double>& data();
+   // Access underlying data structure, ghost entries included.
+   std::vector<Real>& data();
+   const std::vector<Real>& data() const { return mData; }
+
+   // Raw view of the storage: raw()[offset(i,j,k)] is entry (i,j,k), and
+   // stepping one cell along x, y or z moves by strideI(), strideJ(), strideK().
+   Real* raw() { return &mData[0] + mOrigin; }
+   const Real* raw() const { return &mData[0] + mOrigin; }
+   int offset(int i, int j, int k) const { return i + k*mStrideK + j*mStrideJ; }
+   int strideI() const { return 1; }
+   int strideJ() const { return mStrideJ; }
+   int strideK() const { return mStrideK; }
+
+   // Number of valid entries along axis 0, 1 or 2.
+   int dim(int axis) const { return mDim[axis]; }
+   double cellSize() const { return mCellSize; }
 
    // Given a point in world coordinates, return the cell index (i,j,k)
    // corresponding to it
-   virtual void getCell(const vec3& pt, int& i, int& j, int& k);
+   void getCell(const vec3& pt, int& i, int& j, int& k) const;
 
 protected:
+   // faceAxis is 0, 1 or 2 for face centered data, -1 for cell centered data.
+   explicit GridData(int faceAxis);
+
+   // Maps idx onto a valid entry along axis; false if it lies outside and
+   // the default value applies.
+   inline bool resolve(int axis, int& idx) const;
+
+   vec3 worldToSelf(const vec3& pt) const;
 
-   virtual vec3 worldToSelf(const vec3& pt) const;
-   double mDfltValue;
+   // Storage offsets of the 4x4x4 interpolation stencil around a point and
+   // the point's fractional position in its cell.
+   struct Stencil
+   {
+      int offX[4], offY[4], offZ[4];
+      double fractx, fracty, fractz;
+   };
+   void getStencil(const vec3& pt, Stencil& s) const;
+   double evaluate(const Stencil& s) const;
+
+   int mFaceAxis;
+   int mDim[3];
+   int mStrideJ;
+   int mStrideK;
+   int mOrigin;
+   double mCellSize;
+   Real mDfltValue;
    vec3 mMax;
-   std::vector<double> mData;
+   std::vector<Real> mData;
 };
 
 class GridDataX : public GridData
 {
 public:
    GridDataX();
-   virtual ~GridDataX();
-   virtual void initialize(double dfltValue = 0.0);
-   virtual double& operator()(int i, int j, int k);
-   virtual const double operator()(int i, int j, int k) const; 
-   virtual vec3 worldToSelf(const vec3& pt) const;
 };
 
 class GridDataY : public GridData
 {
 public:
    GridDataY();
-   virtual ~GridDataY();
-   virtual void initialize(double dfltValue = 0.0);
-   virtual double& operator()(int i, int j, int k);
-   virtual const double operator()(int i, int j, int k) const; 
-   virtual vec3 worldToSelf(const vec3& pt) const;
 };
 
 class GridDataZ : public GridData
 {
 public:
    GridDataZ();
-   virtual ~GridDataZ();
-   virtual void initialize(double dfltValue = 0.0);
-   virtual double& operator()(int i, int j, int k);
-   virtual const double operator()(int i, int j, int k) const; 
-   virtual vec3 worldToSelf(const vec3& pt) const;
 };
 
-#endif
\ No newline at end of file
+inline bool GridData::resolve(int axis, int& idx) const
+{
+   if (idx >= 0 && idx < mDim[axis]) return true;
+   if (axis == mFaceAxis || mFaceAxis < 0) return false;
+   idx = idx < 0 ? 0 : mDim[axis]-1;
+   return true;
+}
+
+inline Real& GridData::operator()(int i, int j, int k)
+{
+   const bool inside = resolve(0, i) && resolve(1, j) && resolve(2, k);
+   assert(inside && "GridData: non-const access out of range");
+   (void) inside;
+   return raw()[offset(i,j,k)];
+}
+
+inline double GridData::operator()(int i, int j, int k) const
+{
+   if (!resolve(0, i) || !resolve(1, j) || !resolve(2, k)) return mDfltValue;
+   return raw()[offset(i,j,k)];
+}
+
+inline Real& GridData::at(int i, int j, int k)
+{
+   return raw()[offset(i,j,k)];
+}
+
+inline double GridData::at(int i, int j, int k) const
+{
+   return raw()[offset(i,j,k)];
+}
+
+inline double GridData::CINT(double q_i_minus_1, double q_i, double q_i_plus_1, double q_i_plus_2, double x) const {
+
+	// The slopes:
+	double d_i = (q_i_plus_1 - q_i_minus_1) / 2.0;
+	double d_i_plus_1 = (q_i_plus_2 - q_i) / 2.0;
+
+	// Delta q:
+	double delta_q = q_i_plus_1 - q_i;
+
+	// Restrict the slopes:
+	if (delta_q > 0) {
+		if (d_i < 0) d_i = 0;
+		if (d_i_plus_1 < 0) d_i_plus_1 = 0;
+	} else if (delta_q < 0) {
+		if (d_i > 0) d_i = 0;
+		if (d_i_plus_1 > 0) d_i_plus_1 = 0;
+	}
+
+	// The Hermite cubic:
+	double q_x = q_i + d_i * x + (3.0 * delta_q - 2.0 * d_i - d_i_plus_1) * (x * x) + (-2.0 * delta_q + d_i + d_i_plus_1) * (x * x * x);
+
+	// Done:
+	return q_x;
+
+}
+
+#endif
@@ -12,11 +12,11 @@ class GridDataMatrix {
 private:
 protected:
 public:
-	GridDataMatrix() {
-		diag.initialize();
-		plusI.initialize();
-		plusJ.initialize();
-		plusK.initialize();
+	void initialize(const SimConfig& config) {
+		diag.initialize(config);
+		plusI.initialize(config);
+		plusJ.initialize(config);
+		plusK.initialize(config);
 	}
 	GridData diag;
 	GridData plusI;
@@ -0,0 +1,199 @@
+#include "grid_kernels.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+
+	// Scratch space for per-slab partial results, grown on demand and reused
+	// so the kernels do not allocate once warmed up.
+	double* slabBuffer(int slabs) {
+		static thread_local std::vector<double> buffer;
+		if ((int) buffer.size() < slabs) buffer.resize(slabs);
+		return &buffer[0];
+	}
+
+	double sumSlabs(const double* partial, int slabs) {
+		double result = 0.0;
+		for (int j = 0; j < slabs; j++) result += partial[j];
+		return result;
+	}
+
+	double maxSlabs(const double* partial, int slabs) {
+		double result = 0.0;
+		for (int j = 0; j < slabs; j++) result = std::max(result, partial[j]);
+		return result;
+	}
+
+}
+
+void GridKernels::fill(GridData & x, double value) {
+	const Real v = value;
+	const int nI = x.dim(0), nJ = x.dim(1), nK = x.dim(2);
+	Real* X = x.raw();
+
+	PARALLEL_FOR
+	for (int j = 0; j < nJ; j++) {
+		for (int k = 0; k < nK; k++) {
+			Real* row = X + x.offset(0, j, k);
+			std::fill(row, row + nI, v);
+		}
+	}
+}
+
+double GridKernels::dot(const GridData & x, const GridData & y) {
+	const int nI = x.dim(0), nJ = x.dim(1), nK = x.dim(2);
+	const Real* X = x.raw();
+	const Real* Y = y.raw();
+	double* partial = slabBuffer(nJ);
+
+	PARALLEL_FOR
+	for (int j = 0; j < nJ; j++) {
+		SolverReal sum = 0.0;
+		for (int k = 0; k < nK; k++) {
+			const int row = x.offset(0, j, k);
+			SIMD_REDUCTION(+, sum)
+			for (int i = row; i < row + nI; i++) {
+				sum += (SolverReal) X[i] * Y[i];
+			}
+		}
+		partial[j] = sum;
+	}
+
+	return sumSlabs(partial, nJ);
+}
+
+double GridKernels::maxMagnitude(const GridData & x) {
+	const int nI = x.dim(0), nJ = x.dim(1), nK = x.dim(2);
+	const Real* X = x.raw();
+	double* partial = slabBuffer(nJ);
+
+	PARALLEL_FOR
+	for (int j = 0; j < nJ; j++) {
+		Real result = 0.0;
+		for (int k = 0; k < nK; k++) {
+			const int row = x.offset(0, j, k);
+			SIMD_REDUCTION(max, result)
+			for (int i = row; i < row + nI; i++) {
+				result = std::max(result, std::fabs(X[i]));
+			}
+		}
+		partial[j] = result;
+	}
+
+	return maxSlabs(partial, nJ);
+}
+
+void GridKernels::apply(const GridDataMatrix & A, const GridData & x, GridData & result) {
+	applyAndDot(A, x, result);
+}
+
+double GridKernels::applyAndDot(const GridDataMatrix & A, const GridData & x, GridData & result) {
+	const int nI = x.dim(0), nJ = x.dim(1), nK = x.dim(2);
+	const int sJ = x.strideJ(), sK = x.strideK();
+	const Real* Ad = A.diag.raw();
+	const Real* Ai = A.plusI.raw();
+	const Real* Aj = A.plusJ.raw();
+	const Real* Ak = A.plusK.raw();
+	const Real* X = x.raw();
+	Real* R = result.raw();
+	double* partial = slabBuffer(nJ);
+
+	// Couplings to solid or outside cells are stored as 0, so neighbors can be
+	// read unconditionally; the ghost layer covers the domain boundary.
+	PARALLEL_FOR
+	for (int j = 0; j < nJ; j++) {
+		SolverReal sum = 0.0;
+		for (int k = 0; k < nK; k++) {
+			const int row = x.offset(0, j, k);
+			SIMD_REDUCTION(+, sum)
+			for (int o = row; o < row + nI; o++) {
+				Real value = Ad[o] * X[o]
+				             + Ai[o] * X[o + 1] + Aj[o] * X[o + sJ] + Ak[o] * X[o + sK]
+				             + Ai[o - 1] * X[o - 1] + Aj[o - sJ] * X[o - sJ] + Ak[o - sK] * X[o - sK];
+				R[o] = value;
+				sum += (SolverReal) value * X[o];
+			}
+		}
+		partial[j] = sum;
+	}
+
+	return sumSlabs(partial, nJ);
+}
+
+double GridKernels::residual(const GridDataMatrix & A, const GridData & p, const GridData & d, GridData & r) {
+	const int nI = p.dim(0), nJ = p.dim(1), nK = p.dim(2);
+	const int sJ = p.strideJ(), sK = p.strideK();
+	const Real* Ad = A.diag.raw();
+	const Real* Ai = A.plusI.raw();
+	const Real* Aj = A.plusJ.raw();
+	const Real* Ak = A.plusK.raw();
+	const Real* P = p.raw();
+	const Real* D = d.raw();
+	Real* R = r.raw();
+	double* partial = slabBuffer(nJ);
+
+	PARALLEL_FOR
+	for (int j = 0; j < nJ; j++) {
+		Real result = 0.0;
+		for (int k = 0; k < nK; k++) {
+			const int row = p.offset(0, j, k);
+			SIMD_REDUCTION(max, result)
+			for (int o = row; o < row + nI; o++) {
+				R[o] = D[o] - (Ad[o] * P[o]
+				               + Ai[o] * P[o + 1] + Aj[o] * P[o + sJ] + Ak[o] * P[o + sK]
+				               + Ai[o - 1] * P[o - 1] + Aj[o - sJ] * P[o - sJ] + Ak[o - sK] * P[o - sK]);
+				result = std::max(result, std::fabs(R[o]));
+			}
+		}
+		partial[j] = result;
+	}
+
+	return maxSlabs(partial, nJ);
+}
+
+double GridKernels::updateSolution(double alpha, const GridData & s, const GridData & z, GridData & p, GridData & r) {
+	const Real a = alpha;
+	const int nI = s.dim(0), nJ = s.dim(1), nK = s.dim(2);
+	const Real* S = s.raw();
+	const Real* Z = z.raw();
+	Real* P = p.raw();
+	Real* R = r.raw();
+	double* partial = slabBuffer(nJ);
+
+	PARALLEL_FOR
+	for (int j = 0; j < nJ; j++) {
+		Real result = 0.0;
+		for (int k = 0; k < nK; k++) {
+			const int row = s.offset(0, j, k);
+			SIMD_REDUCTION(max, result)
+			for (int i = row; i < row + nI; i++) {
+				P[i] += a * S[i];
+				R[i] -= a * Z[i];
+				result = std::max(result, std::fabs(R[i]));
+			}
+		}
+		partial[j] = result;
+	}
+
+	return maxSlabs(partial, nJ);
+}
+
+void GridKernels::updateSearch(double beta, const GridData & z, GridData & s) {
+	const Real b = beta;
+	const int nI = s.dim(0), nJ = s.dim(1), nK = s.dim(2);
+	const Real* Z = z.raw();
+	Real* S = s.raw();
+
+	PARALLEL_FOR
+	for (int j = 0; j < nJ; j++) {
+		for (int k = 0; k < nK; k++) {
+			const int row = s.offset(0, j, k);
+			SIMD_LOOP
+			for (int i = row; i < row + nI; i++) {
+				S[i] = Z[i] + b * S[i];
+			}
+		}
+	}
+}
@@ -0,0 +1,40 @@
+// Fused vector kernels for the pressure solve.
+//
+// All vectors are cell centered GridData of the same size. The kernels walk
+// the storage row by row (i is contiguous), touch only valid cells and leave
+// the ghost layer at zero. Reductions are accumulated per j slab and then
+// summed in slab order, so results do not depend on the number of threads.
+// Vectors hold Real; dot products accumulate in SolverReal (see real.h).
+
+#ifndef GRID_KERNELS_H
+#define GRID_KERNELS_H
+
+#include "grid_data.h"
+#include "grid_data_matrix.h"
+
+namespace GridKernels {
+
+	extern void fill(GridData & x, double value);
+
+	extern double dot(const GridData & x, const GridData & y);
+
+	extern double maxMagnitude(const GridData & x);
+
+	// result = A * x
+	extern void apply(const GridDataMatrix & A, const GridData & x, GridData & result);
+
+	// result = A * x, returns dot(result, x)
+	extern double applyAndDot(const GridDataMatrix & A, const GridData & x, GridData & result);
+
+	// r = d - A * p, returns maxMagnitude(r)
+	extern double residual(const GridDataMatrix & A, const GridData & p, const GridData & d, GridData & r);
+
+	// p += alpha * s, r -= alpha * z, returns maxMagnitude(r)
+	extern double updateSolution(double alpha, const GridData & s, const GridData & z, GridData & p, GridData & r);
+
+	// s = z + beta * s
+	extern void updateSearch(double beta, const GridData & z, GridData & s);
+
+}
+
+#endif // GRID_KERNELS_H
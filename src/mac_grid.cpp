@@ -1,79 +1,96 @@
 #include "mac_grid.h"
 #include "open_gl_headers.h" 
+#ifndef SMOKE_HEADLESS
 #include "camera.h"
+#endif
 #include "custom_output.h" 
 #include "constants.h" 
+#include "parallel.h"
+#include "cache_writer.h"
+#include <assert.h>
 #include <math.h>
+#include <algorithm>
 #include <map>
 #include <stdio.h>
 #include <cstdlib>
+#include <limits>
 #undef max
 #undef min 
 #include <fstream> 
 
 
-// Globals
-MACGrid target;
-
-
 // NOTE: x -> cols, z -> rows, y -> stacks
 MACGrid::RenderMode MACGrid::theRenderMode = SHEETS; // { CUBES; SHEETS; }
 MACGrid::BackTraceMode MACGrid::theBackTraceMode = RK2; // { FORWARDEULER, RK2 };
 MACGrid::SourceType MACGrid::theSourceType = CUBECENTER; // { INIT, CUBECENTER, TWOSOURCE };
+MACGrid::Preconditioner MACGrid::thePreconditioner = MIC0; // { NOPRECONDITIONER, MIC0, MULTIGRID };
+MACGrid::PressureSolver MACGrid::thePressureSolver = PCGSOLVER; // { PCGSOLVER, MULTIGRIDSOLVER };
 bool MACGrid::theDisplayVel = false; //true
+double MACGrid::theSmokeCutoff = 1e-6;
+bool MACGrid::theWarmStart = false;
 
+// Traversals follow the storage order of GridData: j slowest, then k, then i.
 #define FOR_EACH_CELL \
-   for(int k = 0; k < theDim[MACGrid::Z]; k++)  \
-      for(int j = 0; j < theDim[MACGrid::Y]; j++) \
-         for(int i = 0; i < theDim[MACGrid::X]; i++) 
+   for(int j = 0; j < mConfig.dim[MACGrid::Y]; j++) \
+      for(int k = 0; k < mConfig.dim[MACGrid::Z]; k++)  \
+         for(int i = 0; i < mConfig.dim[MACGrid::X]; i++) 
 
 #define FOR_EACH_CELL_REVERSE \
-   for(int k = theDim[MACGrid::Z] - 1; k >= 0; k--)  \
-      for(int j = theDim[MACGrid::Y] - 1; j >= 0; j--) \
-         for(int i = theDim[MACGrid::X] - 1; i >= 0; i--) 
+   for(int j = mConfig.dim[MACGrid::Y] - 1; j >= 0; j--) \
+      for(int k = mConfig.dim[MACGrid::Z] - 1; k >= 0; k--)  \
+         for(int i = mConfig.dim[MACGrid::X] - 1; i >= 0; i--) 
 
 #define FOR_EACH_FACE \
-   for(int k = 0; k < theDim[MACGrid::Z]+1; k++) \
-      for(int j = 0; j < theDim[MACGrid::Y]+1; j++) \
-         for(int i = 0; i < theDim[MACGrid::X]+1; i++) 
+   for(int j = 0; j < mConfig.dim[MACGrid::Y]+1; j++) \
+      for(int k = 0; k < mConfig.dim[MACGrid::Z]+1; k++) \
+         for(int i = 0; i < mConfig.dim[MACGrid::X]+1; i++) 
 
 
 #define FOR_EACH_YFACE \
-   for(int k = 0; k < theDim[MACGrid::Z]; k++) \
-      for(int j = 0; j < theDim[MACGrid::Y]+1; j++) \
-         for(int i = 0; i < theDim[MACGrid::X]; i++)
+   for(int j = 0; j < mConfig.dim[MACGrid::Y]+1; j++) \
+      for(int k = 0; k < mConfig.dim[MACGrid::Z]; k++) \
+         for(int i = 0; i < mConfig.dim[MACGrid::X]; i++)
 
+#define PARALLEL_FOR_EACH_CELL \
+   PARALLEL_FOR \
+   FOR_EACH_CELL
 
+#define PARALLEL_FOR_EACH_FACE \
+   PARALLEL_FOR \
+   FOR_EACH_FACE
 
-MACGrid::MACGrid()
-{
-   initialize();
-}
+// Cache blocked traversals for stencil passes. The k range is cut into slabs
+// of SWEEP_TILE rows and each slab is swept one j plane at a time, so the
+// planes a +-1 stencil reads are still cached when the next j comes round.
+// The slabs are split across threads, the same restriction applies.
+#define SWEEP_TILE 8
+
+#define PARALLEL_FOR_EACH_TILED(nI, nJ, nK) \
+   PARALLEL_FOR \
+   for(int kTile = 0; kTile < (nK); kTile += SWEEP_TILE) \
+      for(int j = 0; j < (nJ); j++) \
+         for(int k = kTile; k < std::min(kTile + SWEEP_TILE, (nK)); k++) \
+            for(int i = 0; i < (nI); i++)
+
+#define PARALLEL_FOR_EACH_CELL_TILED \
+   PARALLEL_FOR_EACH_TILED(mConfig.dim[MACGrid::X], mConfig.dim[MACGrid::Y], mConfig.dim[MACGrid::Z])
+
+#define PARALLEL_FOR_EACH_FACE_TILED \
+   PARALLEL_FOR_EACH_TILED(mConfig.dim[MACGrid::X]+1, mConfig.dim[MACGrid::Y]+1, mConfig.dim[MACGrid::Z]+1)
 
-MACGrid::MACGrid(const MACGrid& orig)
+#define PARALLEL_FOR_EACH_YFACE_TILED \
+   PARALLEL_FOR_EACH_TILED(mConfig.dim[MACGrid::X], mConfig.dim[MACGrid::Y]+1, mConfig.dim[MACGrid::Z])
+
+
+
+MACGrid::MACGrid()
 {
-   mU = orig.mU;
-   mV = orig.mV;
-   mW = orig.mW;
-   mP = orig.mP;
-   mD = orig.mD;
-   mT = orig.mT;
+   initialize(SimConfig());
 }
 
-MACGrid& MACGrid::operator=(const MACGrid& orig)
+MACGrid::MACGrid(const SimConfig& config)
 {
-   if (&orig == this)
-   {
-      return *this;
-   }
-   mU = orig.mU;
-   mV = orig.mV;
-   mW = orig.mW;
-   mP = orig.mP;
-   mD = orig.mD;
-   mT = orig.mT;   
-
-   return *this;
+   initialize(config);
 }
 
 MACGrid::~MACGrid()
@@ -82,294 +99,279 @@ MACGrid::~MACGrid()
 
 void MACGrid::reset()
 {
-   mU.initialize();
-   mV.initialize();
-   mW.initialize();
-   mP.initialize();
-   mD.initialize();
-   mT.initialize(0.0);
+   mU.initialize(mConfig);
+   mV.initialize(mConfig);
+   mW.initialize(mConfig);
+   mP.initialize(mConfig);
+   mD.initialize(mConfig);
+   mT.initialize(mConfig, 0.0);
 
-    if(useEigen)
-        calculateEigenAMatrix();
-    else {
-        calculateAMatrix();
-        calculatePreconditioner(AMatrix);
-    }
+   mUNext.initialize(mConfig);
+   mVNext.initialize(mConfig);
+   mWNext.initialize(mConfig);
+   mDNext.initialize(mConfig);
+   mTNext.initialize(mConfig);
 
-}
+   mSolverR.initialize(mConfig);
+   mSolverZ.initialize(mConfig);
+   mSolverS.initialize(mConfig);
+   mSolverQ.initialize(mConfig);
+
+   mSmokeTiles.initialize(mConfig);
+   updateSmokeTiles();
+
+   // Same emission sequence after every reset.
+   mSourceFrame = 0;
+
+    calculatePressureMatrix();
 
-void MACGrid::initialize()
-{
-   reset();
 }
 
-void MACGrid::updateSources()
+void MACGrid::initialize(const SimConfig& config)
 {
-    // Set initial values for density, temperature, velocity
-
-    if(theSourceType == INIT) {
-        // used in [32, 32, 1] grid
-        for (int i = 6; i < 12; i++) {
-            for (int j = 0; j < 5; j++) {
-                mV(i, j + 1, 0) = 2.0;
-                mD(i, j, 0) = 1.0;
-                mT(i, j, 0) = 1.0;
-
-                mV(i, j + 2, 0) = 2.0;
-                mD(i, j, 0) = 1.0;
-                mT(i, j, 0) = 1.0;
-            }
-        }
+   mConfig = config;
 
+   // The obstacle box spans the middle half of the domain along X, and is
+   // left out on grids too small to flow around it.
+   boxMin = mConfig.dim[0] >= 16 ? mConfig.dim[0] / 4 : -1;
+   boxMax = mConfig.dim[0] >= 16 ? 3 * mConfig.dim[0] / 4 : -2;
+   boxUp = true;
+   mSolids.initialize(mConfig);
+   setBoxSolids();
 
-        // Refresh particles in source.
-        for (int i = 6; i < 12; i++) {
-            for (int j = 0; j < 5; j++) {
-                for (int k = 0; k <= 0; k++) {
-                    vec3 cell_center(theCellSize * (i + 0.5), theCellSize * (j + 0.5), theCellSize * (k + 0.5));
-                    for (int p = 0; p < 10; p++) {
-                        double a = ((float) rand() / RAND_MAX - 0.5) * theCellSize;
-                        double b = ((float) rand() / RAND_MAX - 0.5) * theCellSize;
-                        double c = ((float) rand() / RAND_MAX - 0.5) * theCellSize;
-                        vec3 shift(a, b, c);
-                        vec3 xp = cell_center + shift;
-                        rendering_particles.push_back(xp);
-                    }
-                }
-            }
-        }
+   rendering_particles.clear();
+   rendering_particles.setCapacity(mConfig.particleCapacity);
 
-    } // end INIT
-
-    else if(theSourceType == CUBECENTER) {
-        if(theDim[0] == 32) {
-            // used in [32, 32, 32] grid
-            for (int i = 12; i < 20; i++) {
-                for (int j = 0; j < 1; j++) {
-                    for (int k = 12; k < 20; k++) {
-                        mV(i, j + 1, k) = 5.0;
-                        mD(i, j, k) = 1.0;
-                        mT(i, j, k) = 1.0;
-                    }
-                }
-            }
+   reset();
+}
 
-            // Refresh particles in source.
-            for (int i = 12; i < 20; i++) {
-                for (int j = 0; j < 1; j++) {
-                    for (int k = 12; k < 20; k++) {
-                        vec3 cell_center(theCellSize * (i + 0.5), theCellSize * (j + 0.5), theCellSize * (k + 0.5));
-                        for (int p = 0; p < 10; p++) {
-                            double a = ((float) rand() / RAND_MAX - 0.5) * theCellSize;
-                            double b = ((float) rand() / RAND_MAX - 0.5) * theCellSize;
-                            double c = ((float) rand() / RAND_MAX - 0.5) * theCellSize;
-                            vec3 shift(a, b, c);
-                            vec3 xp = cell_center + shift;
-                            rendering_particles.push_back(xp);
-                        }
-                    }
-                }
-            }
-        }
+namespace {
 
-        else if(theDim[0] == 64) {
-            // used in [64, 64, 64] grid
-            for (int i = 20; i < 42; i++) {
-                for (int j = 0; j < 2; j++) {
-                    for (int k = 26; k < 38; k++) {
-                        mV(i, j + 1, k) = 5.0;
-                        mD(i, j, k) = 1.0;
-                        mT(i, j, k) = 1.0;
-                    }
-                }
-            }
+	// A block of source cells [lo, hi) filled with smoke. The velocity
+	// component axis (0, 1, 2 for U, V, W) is speed on the upper faces of the cells.
+	struct SourceRegion {
+		int lo[3];
+		int hi[3];
+		int axis;
+		double speed;
+		int particlesPerCell;
+	};
 
-            // Refresh particles in source.
-            for (int i = 20; i < 42; i++) {
-                for (int j = 0; j < 2; j++) {
-                    for (int k = 26; k < 38; k++) {
-                        vec3 cell_center(theCellSize * (i + 0.5), theCellSize * (j + 0.5), theCellSize * (k + 0.5));
-                        for (int p = 0; p < 10; p++) {
-                            double a = ((float) rand() / RAND_MAX - 0.5) * theCellSize;
-                            double b = ((float) rand() / RAND_MAX - 0.5) * theCellSize;
-                            double c = ((float) rand() / RAND_MAX - 0.5) * theCellSize;
-                            vec3 shift(a, b, c);
-                            vec3 xp = cell_center + shift;
-                            rendering_particles.push_back(xp);
-                        }
-                    }
-                }
-            }
-        }
+	SourceRegion makeRegion(int iLo, int jLo, int kLo, int iHi, int jHi, int kHi, int axis, double speed, int particlesPerCell = 10)
+	{
+		SourceRegion r = { { iLo, jLo, kLo }, { iHi, jHi, kHi }, axis, speed, particlesPerCell };
+		return r;
+	}
 
-        // to test
-        else if(theDim[0] == 3) {
-            // used in [3, 3, 3] grid
-            mV(0, 1, 1) = 1.0;
-            mD(0, 0, 1) = 1.0;
-            mT(0, 0, 1) = 1.0;
-        }
+	// Maps a region laid out for a 64^3 grid onto dim, keeping at least one cell per axis.
+	SourceRegion scaleRegion(SourceRegion r, const int dim[3])
+	{
+		for (int a = 0; a < 3; a++) {
+			r.lo[a] = r.lo[a] * dim[a] / 64;
+			r.hi[a] = std::max(r.hi[a] * dim[a] / 64, r.lo[a] + 1);
+		}
+		return r;
+	}
 
-        else if(theDim[0] == 16) {
-            // used in [16, 16, 16] grid
-            for (int i = 5; i < 13; i++) {
-                for (int j = 0; j < 2; j++) {
-                    for (int k = 5; k < 13; k++) {
-                        mV(i, j + 1, k) = 5.0;
-                        mD(i, j, k) = 1.0;
-                        mT(i, j, k) = 1.0;
-                    }
-                }
-            }
+	// Source regions of type for a grid of size dim. The tuned layouts of the
+	// 16, 32 and 64 cell grids are kept as is, other sizes scale the 64 layout.
+	std::vector<SourceRegion> sourceRegions(MACGrid::SourceType type, const int dim[3])
+	{
+		std::vector<SourceRegion> regions;
+		const int n = dim[0];
 
-            // Refresh particles in source.
-            for (int i = 5; i < 13; i++) {
-                for (int j = 0; j < 2; j++) {
-                    for (int k = 5; k < 13; k++) {
-                        vec3 cell_center(theCellSize * (i + 0.5), theCellSize * (j + 0.5), theCellSize * (k + 0.5));
-                        for (int p = 0; p < 10; p++) {
-                            double a = ((float) rand() / RAND_MAX - 0.5) * theCellSize;
-                            double b = ((float) rand() / RAND_MAX - 0.5) * theCellSize;
-                            double c = ((float) rand() / RAND_MAX - 0.5) * theCellSize;
-                            vec3 shift(a, b, c);
-                            vec3 xp = cell_center + shift;
-                            rendering_particles.push_back(xp);
-                        }
-                    }
-                }
-            }
-        }
-    }
+		if (type == MACGrid::INIT) {
+			// used in [32, 32, 1] grid
+			regions.push_back(makeRegion(6, 0, 0, 12, 5, 1, 1, 2.0));
+		}
 
-    else if(theSourceType == TWOSOURCE) {
-        if(theDim[0] == 32) {
-            // used in [32, 32, 32] grid
-            for (int i = 0; i < 2; i++) {
-                for (int j = 5; j < 7; j++) {
-                    for (int k = 15; k < 17; k++) {
-                        mU(i, j + 1, k) = 5.0;
-                        mD(i, j, k) = 1.0;
-                        mT(i, j, k) = 1.0;
-                    }
-                }
-            }
+		else if (type == MACGrid::CUBECENTER) {
+			if (n == 32) regions.push_back(makeRegion(12, 0, 12, 20, 1, 20, 1, 5.0));
+			else if (n == 64) regions.push_back(makeRegion(20, 0, 26, 42, 2, 38, 1, 5.0));
+			else if (n == 3) regions.push_back(makeRegion(0, 0, 1, 1, 1, 2, 1, 1.0, 0)); // to test
+			else if (n == 16) regions.push_back(makeRegion(5, 0, 5, 13, 2, 13, 1, 5.0));
+			else regions.push_back(scaleRegion(makeRegion(20, 0, 26, 42, 2, 38, 1, 5.0), dim));
+		}
 
-            for (int i = theDim[0] - 2; i < theDim[0]; i++) {
-                for (int j = 5; j < 7; j++) {
-                    for (int k = 15; k < 17; k++) {
-                        mU(i, j + 1, k) = -5.0;
-                        mD(i, j, k) = 1.0;
-                        mT(i, j, k) = 1.0;
-                    }
-                }
-            }
+		else if (type == MACGrid::TWOSOURCE) {
+			// Two jets facing each other from the X walls.
+			SourceRegion left, right;
+			if (n == 32) {
+				left = makeRegion(0, 5, 15, 2, 7, 17, 0, 5.0);
+			}
+			else {
+				left = makeRegion(0, 10, 30, 2, 15, 35, 0, 5.0);
+				if (n != 64) left = scaleRegion(left, dim);
+				left.lo[0] = 0;
+				left.hi[0] = 2;
+			}
+			right = left;
+			right.lo[0] = n - 2;
+			right.hi[0] = n;
+			right.speed = -5.0;
+			regions.push_back(left);
+			regions.push_back(right);
+		}
 
-            // Refresh particles in source.
-            for (int i = 0; i < 2; i++) {
-                for (int j = 5; j < 7; j++) {
-                    for (int k = 15; k < 17; k++) {
-                        vec3 cell_center(theCellSize * (i + 0.5), theCellSize * (j + 0.5), theCellSize * (k + 0.5));
-                        for (int p = 0; p < 10; p++) {
-                            double a = ((float) rand() / RAND_MAX - 0.5) * theCellSize;
-                            double b = ((float) rand() / RAND_MAX - 0.5) * theCellSize;
-                            double c = ((float) rand() / RAND_MAX - 0.5) * theCellSize;
-                            vec3 shift(a, b, c);
-                            vec3 xp = cell_center + shift;
-                            rendering_particles.push_back(xp);
-                        }
-                    }
-                }
-            }
+		return regions;
+	}
 
-            for (int i = theDim[0] - 2; i < theDim[0]; i++) {
-                for (int j = 5; j < 7; j++) {
-                    for (int k = 15; k < 17; k++) {
-                        vec3 cell_center(theCellSize * (i + 0.5), theCellSize * (j + 0.5), theCellSize * (k + 0.5));
-                        for (int p = 0; p < 10; p++) {
-                            double a = ((float) rand() / RAND_MAX - 0.5) * theCellSize;
-                            double b = ((float) rand() / RAND_MAX - 0.5) * theCellSize;
-                            double c = ((float) rand() / RAND_MAX - 0.5) * theCellSize;
-                            vec3 shift(a, b, c);
-                            vec3 xp = cell_center + shift;
-                            rendering_particles.push_back(xp);
-                        }
-                    }
-                }
-            }
-        }
+	// The built-in sources of type as emitters for the first 100 frames,
+	// boxes around exactly the cells of their regions.
+	std::vector<Emitter> sourceEmitters(MACGrid::SourceType type, const SimConfig& config)
+	{
+		std::vector<SourceRegion> regions = sourceRegions(type, config.dim);
+		std::vector<Emitter> emitters;
+		for (size_t r = 0; r < regions.size(); r++) {
+			const SourceRegion& src = regions[r];
+			Emitter e = Emitter::box(vec3(src.lo[0], src.lo[1], src.lo[2]) * config.cellSize,
+			                         vec3(src.hi[0], src.hi[1], src.hi[2]) * config.cellSize);
+			e.velocity[src.axis] = src.speed;
+			e.particlesPerCell = src.particlesPerCell;
+			emitters.push_back(e);
+		}
+		return emitters;
+	}
 
-        else if(theDim[0] == 64) {
-            // used in [64, 64, 64] grid
-            for (int i = 0; i < 2; i++) {
-                for (int j = 10; j < 15; j++) {
-                    for (int k = 30; k < 35; k++) {
-                        mU(i, j + 1, k) = 5.0;
-                        mD(i, j, k) = 1.0;
-                        mT(i, j, k) = 1.0;
-                    }
-                }
-            }
+}
 
-            for (int i = theDim[0] - 2; i < theDim[0]; i++) {
-                for (int j = 10; j < 15; j++) {
-                    for (int k = 30; k < 35; k++) {
-                        mU(i, j + 1, k) = -5.0;
-                        mD(i, j, k) = 1.0;
-                        mT(i, j, k) = 1.0;
-                    }
-                }
-            }
+void MACGrid::calculatePressureMatrix()
+{
+    if(useEigen)
+        calculateEigenAMatrix();
+    else {
+        calculateAMatrix();
+        calculatePreconditioner(AMatrix);
+    }
+}
 
-            // Refresh particles in source.
-            for (int i = 0; i < 2; i++) {
-                for (int j = 10; j < 15; j++) {
-                    for (int k = 30; k < 35; k++) {
-                        vec3 cell_center(theCellSize * (i + 0.5), theCellSize * (j + 0.5), theCellSize * (k + 0.5));
-                        for (int p = 0; p < 10; p++) {
-                            double a = ((float) rand() / RAND_MAX - 0.5) * theCellSize;
-                            double b = ((float) rand() / RAND_MAX - 0.5) * theCellSize;
-                            double c = ((float) rand() / RAND_MAX - 0.5) * theCellSize;
-                            vec3 shift(a, b, c);
-                            vec3 xp = cell_center + shift;
-                            rendering_particles.push_back(xp);
-                        }
-                    }
-                }
-            }
+void MACGrid::saveState(CheckpointWriter& out) const
+{
+   out.write(mConfig);
+   out.write(boxMin);
+   out.write(boxMax);
+   out.write(boxUp);
+   out.writeSolids(mSolids);
+   out.writeGrid(mU);
+   out.writeGrid(mV);
+   out.writeGrid(mW);
+   out.writeGrid(mP);
+   out.writeGrid(mD);
+   out.writeGrid(mT);
+   out.writeParticles(rendering_particles);
+   out.write(mSourceFrame);
+}
 
-            for (int i = theDim[0] - 2; i < theDim[0]; i++) {
-                for (int j = 10; j < 15; j++) {
-                    for (int k = 30; k < 35; k++) {
-                        vec3 cell_center(theCellSize * (i + 0.5), theCellSize * (j + 0.5), theCellSize * (k + 0.5));
-                        for (int p = 0; p < 10; p++) {
-                            double a = ((float) rand() / RAND_MAX - 0.5) * theCellSize;
-                            double b = ((float) rand() / RAND_MAX - 0.5) * theCellSize;
-                            double c = ((float) rand() / RAND_MAX - 0.5) * theCellSize;
-                            vec3 shift(a, b, c);
-                            vec3 xp = cell_center + shift;
-                            rendering_particles.push_back(xp);
-                        }
-                    }
+bool MACGrid::loadState(CheckpointReader& in)
+{
+   SimConfig config;
+   if (!in.read(config)) return false;
+   SimConfig previous = mConfig;
+   initialize(config);
+
+   in.read(boxMin);
+   in.read(boxMax);
+   in.read(boxUp);
+   in.readSolids(mSolids);
+   calculatePressureMatrix();
+
+   in.readGrid(mU);
+   in.readGrid(mV);
+   in.readGrid(mW);
+   in.readGrid(mP);
+   in.readGrid(mD);
+   in.readGrid(mT);
+   in.readParticles(rendering_particles);
+   in.read(mSourceFrame);
+   updateSmokeTiles();
+
+   if (in.failed()) {
+      initialize(previous);
+      return false;
+   }
+   return true;
+}
+
+void MACGrid::updateSources()
+{
+    // Set initial values for density, temperature, velocity from the scene's
+    // emitters, or from the built-in sources of theSourceType without a scene.
+    const int frame = (int) mSourceFrame;
+    const std::vector<Emitter> builtIn = mEmitters.empty() ? sourceEmitters(theSourceType, mConfig) : std::vector<Emitter>();
+    const std::vector<Emitter>& emitters = mEmitters.empty() ? builtIn : mEmitters;
+
+    for (size_t e = 0; e < emitters.size(); e++) {
+        const Emitter& src = emitters[e];
+        if (!src.isActive(frame)) continue;
+
+        // Rasterize over the emitter's bounds only.
+        int lo[3], hi[3];
+        src.cellBounds(mConfig, lo, hi);
+        mSourceCells.clear();
+        for (int j = lo[1]; j < hi[1]; j++) {
+            for (int k = lo[2]; k < hi[2]; k++) {
+                for (int i = lo[0]; i < hi[0]; i++) {
+                    if (!src.contains(getCenter(i, j, k))) continue;
+                    if (src.velocity[0] != 0) mU(i + 1, j, k) = src.velocity[0];
+                    if (src.velocity[1] != 0) mV(i, j + 1, k) = src.velocity[1];
+                    if (src.velocity[2] != 0) mW(i, j, k + 1) = src.velocity[2];
+                    mD(i, j, k) = src.density;
+                    mT(i, j, k) = src.temperature;
+                    mSmokeTiles.activateCell(i, j, k);
+                    mSourceCells.push_back(getCellIndex(i, j, k));
                 }
             }
         }
+
+        // Refresh particles in source.
+        emitParticles(mSourceCells, src.particlesPerCell, (int) e);
     }
+    mSourceFrame++;
+}
 
+void MACGrid::emitParticles(const std::vector<int>& cells, int particlesPerCell, int source)
+{
+    // Every cell draws its jitter from its own generator, keyed by frame,
+    // source and cell, and owns a fixed slice of the new particles, so the
+    // cells fill in parallel and the result does not depend on the number of
+    // threads. Cells past the capacity of the pool emit nothing.
+    const int numCells = (int) cells.size();
+    if (numCells == 0 || particlesPerCell <= 0) return;
+    int first = 0;
+    const int count = rendering_particles.grow(numCells * particlesPerCell, first);
+    float* position[3];
+    for (int axis = 0; axis < 3; axis++) position[axis] = rendering_particles.positions(axis) + first;
+    const int nI = mConfig.dim[MACGrid::X], nJ = mConfig.dim[MACGrid::Y];
+
+    PARALLEL_FOR
+    for (int cell = 0; cell < (count + particlesPerCell - 1) / particlesPerCell; cell++) {
+        const int index = cells[cell];
+        const int i = index % nI, j = (index / nI) % nJ, k = index / (nI * nJ);
+        Random random(Random::hash(mSourceFrame, source, index));
+        vec3 cell_center = getCenter(i, j, k);
+        for (int p = cell * particlesPerCell; p < std::min((cell + 1) * particlesPerCell, count); p++) {
+            double a = (random.uniform() - 0.5) * mConfig.cellSize;
+            double b = (random.uniform() - 0.5) * mConfig.cellSize;
+            double c = (random.uniform() - 0.5) * mConfig.cellSize;
+            vec3 xp = cell_center + vec3(a, b, c);
+            for (int axis = 0; axis < 3; axis++) position[axis][p] = xp[axis];
+        }
+    }
 }
 
 
 void MACGrid::advectVelocity (double dt)
 {
-    // TODO: Calculate new velocities and store in target
+    // TODO: Calculate new velocities and store in mUNext, mVNext and mWNext
 
 
     // TODO: Get rid of these three lines after you implement yours
-	//target.mU = mU;
-    //target.mV = mV;
-    //target.mW = mW;
+	//mUNext = mU;
+    //mVNext = mV;
+    //mWNext = mW;
 
-    // TODO: Your code is here. It builds target.mU, target.mV and target.mW for all faces
-    FOR_EACH_FACE {
+    // TODO: Your code is here. It builds mUNext, mVNext and mWNext for all faces
+    PARALLEL_FOR_EACH_FACE {
         // we have X-face(i,j,k), where i~[0, dim[X], j~[0, dim[Y]-1], k~[0, dim[Z]-1]
                 // Y-face(i,j,k), where i~[0, dim[X]-1, j~[0, dim[Y]], k~[0, dim[Z]-1]
                 // Z-face(i,j,k), where i~[0, dim[X]-1, j~[0, dim[Y]]-1, k~[0, dim[Z]]
@@ -377,8 +379,8 @@ void MACGrid::advectVelocity (double dt)
         //std::cout << i << ", " << j << ", " << k << ": " << std::endl;
 
         if(isValidFace(MACGrid::X, i, j, k)) {
-            if(i == 0 || i == theDim[MACGrid::X] || isBoxBoundaryFace(MACGrid::X, i, j, k)) {
-                target.mU(i, j, k) = 0;
+            if(mSolids.isWallFace(MACGrid::X, i, j, k)) {
+                mUNext(i, j, k) = 0;
             }
             else {
                 vec3 curPosXface = getFacePosition(MACGrid::X, i, j, k);
@@ -417,13 +419,13 @@ void MACGrid::advectVelocity (double dt)
 
                 vec3 clippedOldPosX = clipToGrid(oldPosXface, curPosXface);
                 vec3 newVelX = getVelocity(clippedOldPosX);
-                target.mU(i, j, k) = newVelX[0];
+                mUNext(i, j, k) = newVelX[0];
             }
         }
 
         if(isValidFace(MACGrid::Y, i, j, k)) {
-            if(j == 0 || j == theDim[MACGrid::Y] || isBoxBoundaryFace(MACGrid::Y, i, j, k)) {
-                target.mV(i, j, k) = 0;
+            if(mSolids.isWallFace(MACGrid::Y, i, j, k)) {
+                mVNext(i, j, k) = 0;
             }
             else {
                 vec3 curPosYface = getFacePosition(MACGrid::Y, i, j, k);
@@ -462,13 +464,13 @@ void MACGrid::advectVelocity (double dt)
 
                 vec3 clippedOldPosY = clipToGrid(oldPosYface, curPosYface);
                 vec3 newVelY = getVelocity(clippedOldPosY);
-                target.mV(i, j, k) = newVelY[1];
+                mVNext(i, j, k) = newVelY[1];
             }
         }
 
         if(isValidFace(MACGrid::Z, i, j, k)) {
-            if(k == 0 || k == theDim[MACGrid::Z] || isBoxBoundaryFace(MACGrid::Z, i, j, k)) {
-                target.mW(i, j, k) = 0;
+            if(mSolids.isWallFace(MACGrid::Z, i, j, k)) {
+                mWNext(i, j, k) = 0;
             }
             else {
                 vec3 curPosZface = getFacePosition(MACGrid::Z, i, j, k);
@@ -506,7 +508,7 @@ void MACGrid::advectVelocity (double dt)
 
                 vec3 clippedOldPosZ = clipToGrid(oldPosZface, curPosZface);
                 vec3 newVelZ = getVelocity(clippedOldPosZ);
-                target.mW(i, j, k) = newVelZ[2];
+                mWNext(i, j, k) = newVelZ[2];
             }
         }
 
@@ -514,179 +516,245 @@ void MACGrid::advectVelocity (double dt)
 
     // Linghan 2018-04-10
 
-    // Then save the result to our object
-    mU = target.mU;
-    mV = target.mV;
-    mW = target.mW;
+    // Then swap the result into our object
+    keepSolidFaces();
+    mU.swap(mUNext);
+    mV.swap(mVNext);
+    mW.swap(mWNext);
 }
 
 void MACGrid::advectTemperature(double dt)
 {
-    // TODO: Calculate new temp and store in target
+    GridData* fields[] = { &mT };
+    GridData* next[] = { &mTNext };
+    advectCellFields(dt, fields, next, 1);
+    mT.swap(mTNext);
+    updateSmokeTiles();
+}
 
-    // TODO: Get rid of this line after you implement yours
-    //target.mT = mT;
+void MACGrid::advectDensity(double dt)
+{
+    GridData* fields[] = { &mD };
+    GridData* next[] = { &mDNext };
+    advectCellFields(dt, fields, next, 1);
+    mD.swap(mDNext);
+    updateSmokeTiles();
+}
 
-    // TODO: Your code is here. It builds target.mT for all cells.
-    FOR_EACH_CELL {
-        if(isInBox(i, j, k)) {
-            target.mT(i, j, k) = 0;
-            continue;
-        }
+void MACGrid::advectDensityAndTemperature(double dt)
+{
+    GridData* fields[] = { &mD, &mT };
+    GridData* next[] = { &mDNext, &mTNext };
+    advectCellFields(dt, fields, next, 2);
+    mD.swap(mDNext);
+    mT.swap(mTNext);
+    updateSmokeTiles();
+}
+
+void MACGrid::updateSmokeTiles()
+{
+    GridData* fields[] = { &mD, &mT };
+    mSmokeTiles.update(fields, 2, theSmokeCutoff);
+}
 
-        vec3 curPos = getCenter(i, j, k);
-        vec3 curVel = getVelocity(curPos);
+int MACGrid::backTraceReach(double dt)
+{
+    // The monotone cubic overshoots its data by at most 8/27 per axis, so no
+    // interpolated velocity component exceeds (35/27)^3 times the largest face
+    // value. A back-trace moves at most dt times that, times sqrt(3) for its
+    // length, and the stencil at its end reads 2 more cells out.
+    double maxComponent = std::max(GridKernels::maxMagnitude(mU), std::max(GridKernels::maxMagnitude(mV), GridKernels::maxMagnitude(mW)));
+    double reach = dt * sqrt(3.0) * pow(35.0 / 27.0, 3) * maxComponent / mConfig.cellSize + 2;
+    return (int) ceil(reach / TileMask::TILE);
+}
 
-        vec3 oldPos;
-        if(theBackTraceMode == FORWARDEULER) {
-            // Forward Euler
-            oldPos = curPos - dt * curVel;
+void MACGrid::advectCellFields(double dt, GridData* const fields[], GridData* const next[], int count)
+{
+    // Cells are traced back CHUNK cells of an x row at a time and sampled in
+    // one batch, so the fields share both the back-trace and the stencils.
+    // The fields are 0 outside mSmokeTiles, so cells whose back-trace cannot
+    // reach those tiles are 0 afterwards and not traced at all.
+    const int n = mConfig.dim[MACGrid::X];
+    const int TILE = TileMask::TILE;
+    const int CHUNK = 32 * TILE; // Batches start on tile boundaries.
+    assert(count <= MAX_CELL_FIELDS);
+    mReachTiles.dilate(mSmokeTiles, backTraceReach(dt));
+    PARALLEL_FOR
+    for(int j = 0; j < mConfig.dim[MACGrid::Y]; j++) {
+        vec3 positions[CHUNK];
+        double values[CHUNK * MAX_CELL_FIELDS];
+        for(int k = 0; k < mConfig.dim[MACGrid::Z]; k++) {
+            for(int first = 0; first < n; first += CHUNK) {
+                const int last = std::min(first + CHUNK, n);
+                int numTraced = 0;
+                for(int i = first; i < last; i++) {
+                    if(!mReachTiles.isActiveCell(i, j, k)) {
+                        i += TILE - 1 - i % TILE;
+                        continue;
+                    }
+                    vec3 curPos = getCenter(i, j, k);
+                    positions[numTraced++] = mSolids.isSolid(i, j, k) ? curPos : backTrace(curPos, dt);
+                }
+                GridData::interpolate(fields, count, positions, numTraced, values);
+                const double* value = values;
+                for(int i = first; i < last; i++) {
+                    bool traced = mReachTiles.isActiveCell(i, j, k);
+                    for(int c = 0; c < count; c++)
+                        (*next[c])(i, j, k) = !traced || mSolids.isSolid(i, j, k) ? 0 : value[c];
+                    if(traced) value += count;
+                }
+            }
         }
+    }
+}
 
-        else if(theBackTraceMode == RK2) {
-            // RK2
-            vec3 midPos = curPos - 0.5 * dt * curVel;
-            vec3 clippedMidPos = clipToGrid(midPos, curPos);
-            vec3 midVel = getVelocity(clippedMidPos);
+vec3 MACGrid::backTrace(const vec3& curPos, double dt)
+{
+    vec3 curVel = getVelocity(curPos);
 
-            oldPos = curPos - dt * midVel;
-        }
+    vec3 oldPos;
+    if(theBackTraceMode == FORWARDEULER) {
+        // Forward Euler
+        oldPos = curPos - dt * curVel;
+    }
 
-        vec3 clippedOldPos = clipToGrid(oldPos, curPos);
-        double newTemp = getTemperature(clippedOldPos);
+    else if(theBackTraceMode == RK2) {
+        // RK2
+        vec3 midPos = curPos - 0.5 * dt * curVel;
+        vec3 clippedMidPos = clipToGrid(midPos, curPos);
+        vec3 midVel = getVelocity(clippedMidPos);
 
-        target.mT(i, j, k) = newTemp;
+        oldPos = curPos - dt * midVel;
     }
-    // Linghan 2018-04-10
 
-    // Then save the result to our object
-    mT = target.mT;
+    return clipToGrid(oldPos, curPos);
 }
 
-
 void MACGrid::advectRenderingParticles(double dt) {
-	rendering_particles_vel.resize(rendering_particles.size());
-	for (size_t p = 0; p < rendering_particles.size(); p++) {
-		vec3 currentPosition = rendering_particles[p];
-        vec3 currentVelocity = getVelocity(currentPosition);
-        vec3 nextPosition = currentPosition + currentVelocity * dt;
-        vec3 clippedNextPosition = clipToGrid(nextPosition, currentPosition);
-        // Keep going...
-        vec3 nextVelocity = getVelocity(clippedNextPosition);
-        vec3 averageVelocity = (currentVelocity + nextVelocity) / 2.0;
-        vec3 betterNextPosition = currentPosition + averageVelocity * dt;
-        vec3 clippedBetterNextPosition = clipToGrid(betterNextPosition, currentPosition);
-        rendering_particles[p] = clippedBetterNextPosition;
-		rendering_particles_vel[p] = averageVelocity;
+	// Particles are independent, so they move in parallel chunks of CHUNK.
+	// Each chunk samples both velocities of its live particles in batches,
+	// one component at a time, and the results do not depend on the number
+	// of threads. Moved particles age by a frame and retire when too old or
+	// out of the smoke.
+	const int CHUNK = 256;
+	const int numParticles = rendering_particles.size();
+	const int numChunks = (numParticles + CHUNK - 1) / CHUNK;
+	const int maxAge = mConfig.particleMaxAge;
+	const double minDensity = mConfig.particleMinDensity;
+	float* position[3];
+	float* velocity[3];
+	for (int axis = 0; axis < 3; axis++) {
+		position[axis] = rendering_particles.positions(axis);
+		velocity[axis] = rendering_particles.velocities(axis);
 	}
-}
-
-void MACGrid::advectDensity(double dt)
-{
-    // TODO: Calculate new densitities and store in target
-
-    // TODO: Get rid of this line after you implement yours
-    //target.mD = mD;
-
-    // TODO: Your code is here. It builds target.mD for all cells.
-	FOR_EACH_CELL {
-        if(isInBox(i, j, k)) {
-            target.mD(i, j, k) = 0;
-            continue;
-        }
-
-		vec3 curPos = getCenter(i, j, k);
-        vec3 curVel = getVelocity(curPos);
-
-		vec3 oldPos;
-		if(theBackTraceMode == FORWARDEULER) {
-			// Forward Euler
-			oldPos = curPos - dt * curVel;
+	int* age = rendering_particles.ages();
+
+	PARALLEL_FOR
+	for (int c = 0; c < numChunks; c++) {
+		const int first = c * CHUNK;
+		const int count = std::min(CHUNK, numParticles - first);
+		int index[CHUNK];
+		vec3 currentPosition[CHUNK], nextPosition[CHUNK];
+		vec3 currentVelocity[CHUNK], nextVelocity[CHUNK];
+
+		int numLive = 0;
+		for (int p = first; p < first + count; p++) {
+			if (age[p] < 0) continue;
+			index[numLive] = p;
+			currentPosition[numLive++] = vec3(position[0][p], position[1][p], position[2][p]);
 		}
+		getVelocities(currentPosition, numLive, currentVelocity);
+		for (int p = 0; p < numLive; p++)
+			nextPosition[p] = clipToGrid(currentPosition[p] + currentVelocity[p] * dt, currentPosition[p]);
+		// Keep going...
+		getVelocities(nextPosition, numLive, nextVelocity);
+		for (int p = 0; p < numLive; p++) {
+			vec3 averageVelocity = (currentVelocity[p] + nextVelocity[p]) / 2.0;
+			vec3 betterNextPosition = currentPosition[p] + averageVelocity * dt;
+			vec3 clippedBetterNextPosition = clipToGrid(betterNextPosition, currentPosition[p]);
+			const int q = index[p];
+			for (int axis = 0; axis < 3; axis++) {
+				position[axis][q] = clippedBetterNextPosition[axis];
+				velocity[axis][q] = averageVelocity[axis];
+			}
 
-		else if(theBackTraceMode == RK2) {
-			// RK2
-			vec3 midPos = curPos - 0.5 * dt * curVel;
-			vec3 clippedMidPos = clipToGrid(midPos, curPos);
-			vec3 midVel = getVelocity(clippedMidPos);
-
-			oldPos = curPos - dt * midVel;
+			int cell[3];
+			for (int axis = 0; axis < 3; axis++)
+				cell[axis] = std::min((int) (clippedBetterNextPosition[axis] / mConfig.cellSize), mConfig.dim[axis] - 1);
+			age[q]++;
+			if ((maxAge > 0 && age[q] > maxAge) || mD(cell[0], cell[1], cell[2]) <= minDensity) age[q] = -1;
 		}
-
-		vec3 clippedOldPos = clipToGrid(oldPos, curPos);
-		double newDens = getDensity(clippedOldPos);
-
-		target.mD(i, j, k) = newDens;
 	}
-	// Linghan 2018-04-10
-
-    // Then save the result to our object
-    mD = target.mD;
-
 }
 
 void MACGrid::computeBuoyancy(double dt)
 {
-	// TODO: Calculate buoyancy and store in target
+	// TODO: Calculate buoyancy and store in mVNext
 
     // TODO: Get rid of this line after you implement yours
-    //target.mV = mV;
-
-    // TODO: Your code is here. It modifies target.mV for all y face velocities.
-    FOR_EACH_YFACE {
-        if(j == 0 || j == theDim[MACGrid::Y] || isBoxBoundaryFace(MACGrid::Y, i, j, k)) target.mV(i, j, k) = 0;
+    //mVNext = mV;
+
+    // TODO: Your code is here. It modifies mVNext for all y face velocities.
+    // Faces whose stencils lie outside the smoke tiles and their neighbours
+    // sample density and temperature 0.
+    mReachTiles.dilate(mSmokeTiles, 1);
+    double ambientDensity = 0.0, ambientTemp = 0.0;
+    double ambientForce = - mConfig.buoyancyAlpha * ambientDensity + mConfig.buoyancyBeta * (ambientTemp - mConfig.buoyancyAmbientTemperature);
+    PARALLEL_FOR_EACH_YFACE_TILED {
+        if(mSolids.isWallFace(MACGrid::Y, i, j, k)) mVNext(i, j, k) = 0;
+        else if(!mReachTiles.isActiveCell(i, j, k)) mVNext(i, j, k) = mV(i, j, k) + ambientForce;
         else {
             vec3 pos = getFacePosition(MACGrid::Y, i, j, k);
             double density = getDensity(pos);
             double temp = getTemperature(pos);
-            double forceBuoy = - theBuoyancyAlpha * density + theBuoyancyBeta * (temp - theBuoyancyAmbientTemperature);
-            target.mV(i, j, k) = mV(i, j, k) + forceBuoy;
+            double forceBuoy = - mConfig.buoyancyAlpha * density + mConfig.buoyancyBeta * (temp - mConfig.buoyancyAmbientTemperature);
+            mVNext(i, j, k) = mV(i, j, k) + forceBuoy;
         }
     }
 
-    /*GridData forceBuoy; forceBuoy.initialize(0.0);
+    /*GridData forceBuoy; forceBuoy.initialize(mConfig, 0.0);
 
     FOR_EACH_CELL {
-        forceBuoy(i, j, k) = - theBuoyancyAlpha * mD(i, j, k)
-                    + theBuoyancyBeta * (mT(i, j, k) - theBuoyancyAmbientTemperature);
+        forceBuoy(i, j, k) = - mConfig.buoyancyAlpha * mD(i, j, k)
+                    + mConfig.buoyancyBeta * (mT(i, j, k) - mConfig.buoyancyAmbientTemperature);
     }
 
     FOR_EACH_YFACE {
-        if(j == 0 || j == theDim[MACGrid::Y]) target.mV(i, j, k) = 0;
+        if(j == 0 || j == mConfig.dim[MACGrid::Y]) mVNext(i, j, k) = 0;
         else {
             double increase = 0.5 * dt * (forceBuoy(i, j - 1, k) + forceBuoy(i, j, k));
-            target.mV(i, j, k) = mV(i, j, k) + increase;
-            //std::cout << target.mV(i, j, k) << " " << mV(i, j, k) << std::endl;
+            mVNext(i, j, k) = mV(i, j, k) + increase;
+            //std::cout << mVNext(i, j, k) << " " << mV(i, j, k) << std::endl;
         }
     }
     // Linghan 2018-04-12 */
 
-    // and then save the result to our object
-    mV = target.mV;
+    // and then swap the result into our object
+    mV.swap(mVNext);
 }
 
 void MACGrid::computeVorticityConfinement(double dt)
 {
    // TODO: Calculate vorticity confinement forces
 
-    // Apply the forces to the current velocity and store the result in target
+    // Apply the forces to the current velocity and store the result in mUNext, mVNext and mWNext
 	// STARTED.
 
     // TODO: Get rid of this line after you implement yours
-	//target.mU = mU;
-	//target.mV = mV;
-	//target.mW = mW;
+	//mUNext = mU;
+	//mVNext = mV;
+	//mWNext = mW;
 
-    // TODO: Your code is here. It modifies target.mU,mV,mW for all faces.
-    GridData omegaX; omegaX.initialize(0.0);
-    GridData omegaY; omegaY.initialize(0.0);
-    GridData omegaZ; omegaZ.initialize(0.0);
-    GridData omegaLength; omegaLength.initialize(0.0);
+    // TODO: Your code is here. It modifies mUNext,mV,mW for all faces.
+    GridData omegaX; omegaX.initialize(mConfig, 0.0);
+    GridData omegaY; omegaY.initialize(mConfig, 0.0);
+    GridData omegaZ; omegaZ.initialize(mConfig, 0.0);
+    GridData omegaLength; omegaLength.initialize(mConfig, 0.0);
 
     // First, for every cell, compute omega vector, and then |omega|
-    double twoSize = 2 * theCellSize;
-    FOR_EACH_CELL {
-        if(isInBox(i, j, k)) continue;
+    double twoSize = 2 * mConfig.cellSize;
+    PARALLEL_FOR_EACH_CELL_TILED {
+        if(mSolids.isSolid(i, j, k)) continue;
 
         double w_i_jplus1_k = getVelocityZ(getCenter(i, j+1, k));
         double w_i_jminus1_k = getVelocityZ(getCenter(i, j-1, k));
@@ -713,63 +781,68 @@ void MACGrid::computeVorticityConfinement(double dt)
     // Second, compute derivative|omega| for each cell respectively.
     // Finally, compute N for each cell and force
 
-    GridData forceConfX; forceConfX.initialize(0.0);
-    GridData forceConfY; forceConfY.initialize(0.0);
-    GridData forceConfZ; forceConfZ.initialize(0.0);
+    GridData forceConfX; forceConfX.initialize(mConfig, 0.0);
+    GridData forceConfY; forceConfY.initialize(mConfig, 0.0);
+    GridData forceConfZ; forceConfZ.initialize(mConfig, 0.0);
 
-    FOR_EACH_CELL {
-        if(isInBox(i, j, k)) continue;
+    // The neighbours of border cells lie outside the grid; the const overload
+    // reads the default value there without writing anything, so the threads
+    // share omegaLength safely.
+    const GridData& length = omegaLength;
+    PARALLEL_FOR_EACH_CELL_TILED {
+        if(mSolids.isSolid(i, j, k)) continue;
 
-        double dOmegaX = (omegaLength(i+1, j, k) - omegaLength(i-1, j, k)) / twoSize;
-        double dOmegaY = (omegaLength(i, j+1, k) - omegaLength(i, j-1, k)) / twoSize;
-        double dOmegaZ = (omegaLength(i, j, k+1) - omegaLength(i, j, k-1)) / twoSize;
+        double dOmegaX = (length(i+1, j, k) - length(i-1, j, k)) / twoSize;
+        double dOmegaY = (length(i, j+1, k) - length(i, j-1, k)) / twoSize;
+        double dOmegaZ = (length(i, j, k+1) - length(i, j, k-1)) / twoSize;
 
         vec3 dOmega(dOmegaX, dOmegaY, dOmegaZ);
         vec3 N = dOmega / (dOmega.Length() + 0.0000000001);
         vec3 omega(omegaX(i, j, k), omegaY(i, j, k), omegaZ(i, j, k));
 
-        vec3 forceConf = theVorticityEpsilon * theCellSize * (N.Cross(omega));
+        vec3 forceConf = mConfig.vorticityEpsilon * mConfig.cellSize * (N.Cross(omega));
 
         forceConfX(i, j, k) = forceConf[0];
         forceConfY(i, j, k) = forceConf[1];
         forceConfZ(i, j, k) = forceConf[2];
     }
 
-    FOR_EACH_FACE {
+    PARALLEL_FOR_EACH_FACE_TILED {
         // X-Face
         if(isValidFace(MACGrid::X, i, j, k)) {
-            if(i == 0 || i == theDim[MACGrid::X] || isBoxBoundaryFace(MACGrid::X, i, j, k)) target.mU(i, j, k) = 0;
+            if(mSolids.isWallFace(MACGrid::X, i, j, k)) mUNext(i, j, k) = 0;
             else {
                 double increase = 0.5 * dt * (forceConfX(i - 1, j, k) + forceConfX(i, j, k));
-                target.mU(i, j, k) = mU(i, j, k) + increase;
+                mUNext(i, j, k) = mU(i, j, k) + increase;
             }
         }
 
         // Y-Face
         if(isValidFace(MACGrid::Y, i, j, k)) {
-            if(j == 0 || j == theDim[MACGrid::Y] || isBoxBoundaryFace(MACGrid::Y, i, j, k)) target.mV(i, j, k) = 0;
+            if(mSolids.isWallFace(MACGrid::Y, i, j, k)) mVNext(i, j, k) = 0;
             else {
                 double increase = 0.5 * dt * (forceConfY(i, j - 1, k) + forceConfY(i, j, k));
-                target.mV(i, j, k) = mV(i, j, k) + increase;
+                mVNext(i, j, k) = mV(i, j, k) + increase;
             }
         }
 
         // Z-Face
         if(isValidFace(MACGrid::Z, i, j, k)) {
-            if(k == 0 || k == theDim[MACGrid::Z] || isBoxBoundaryFace(MACGrid::Z, i, j, k)) target.mW(i, j, k) = 0;
+            if(mSolids.isWallFace(MACGrid::Z, i, j, k)) mWNext(i, j, k) = 0;
             else {
                 double increase = 0.5 * dt * (forceConfZ(i, j, k - 1) + forceConfZ(i, j, k));
-                target.mW(i, j, k) = mW(i, j, k) + increase;
+                mWNext(i, j, k) = mW(i, j, k) + increase;
             }
         }
     }
 
     // Linghan 2018-04-12
 
-    // Then save the result to our object
-    mU = target.mU;
-    mV = target.mV;
-    mW = target.mW;
+    // Then swap the result into our object
+    keepSolidFaces();
+    mU.swap(mUNext);
+    mV.swap(mVNext);
+    mW.swap(mWNext);
 }
 
 void MACGrid::computeWind() {
@@ -777,16 +850,17 @@ void MACGrid::computeWind() {
     FOR_EACH_FACE {
                 // X-Face
          if (isValidFace(MACGrid::X, i, j, k)) {
-             if (i == 0 || i == theDim[MACGrid::X]) target.mU(i, j, k) = 0;
+             if (i == 0 || i == mConfig.dim[MACGrid::X]) mUNext(i, j, k) = 0;
              else {
-                 if(j < 20) target.mU(i, j, k) = mU(i, j, k) + 1;
-                 else if(j < 40) target.mU(i, j, k) = mU(i, j, k) - 1;
-                 else target.mU(i, j, k) = mU(i, j, k) + 1;
+                 if(j < 20) mUNext(i, j, k) = mU(i, j, k) + 1;
+                 else if(j < 40) mUNext(i, j, k) = mU(i, j, k) - 1;
+                 else mUNext(i, j, k) = mU(i, j, k) + 1;
              }
          }
     }
 
-    mU = target.mU;
+    keepSolidFaces();
+    mU.swap(mUNext);
 }
 
 void MACGrid::addExternalForces(double dt)
@@ -802,26 +876,29 @@ void MACGrid::project(double dt)
    // 1. Contruct d
    // 2. Construct A 
    // 3. Solve for p
-   // Subtract pressure from our velocity and save in target
+   // Subtract pressure from our velocity and save in mUNext, mVNext and mWNext
 	// STARTED.
 
     // TODO: Get rid of these 3 lines after you implement yours
-    //target.mU = mU;
-	//target.mV = mV;
-	//target.mW = mW;
+    //mUNext = mU;
+	//mVNext = mV;
+	//mWNext = mW;
 
 
-    // TODO: Your code is here. It solves for a pressure field and modifies target.mU,mV,mW for all faces.
+    // TODO: Your code is here. It solves for a pressure field and modifies mUNext,mV,mW for all faces.
     // First, construct d, the entry of which is - (u_i+1,j,k - u_i,j,k + v_i,j+1,k - v_i,j,k + w_i,j,k+1 - w_i,j,k) * h * rho / dt
     // For boundary, if cell (i+1, j, k) is solid, then, + u(i+1, j, k) * h * rho / dt
     GridData d;
-    d.initialize(0.0);
+    d.initialize(mConfig, 0.0);
 
-    double h_rho_by_dt = theCellSize * theAirDensity / dt;
+    double h_rho_by_dt = mConfig.cellSize * mConfig.airDensity / dt;
     double dt_by_h_rho = 1 / h_rho_by_dt;
 
-    FOR_EACH_CELL {
-        if(isInBox(i, j, k)) continue;
+    PARALLEL_FOR_EACH_CELL_TILED {
+        if(mSolids.isSolid(i, j, k)) {
+            mP(i, j, k) = 0; // Cells a solid moved into must not seed a warm start.
+            continue;
+        }
 
         d(i, j, k) = (mU(i, j, k) - mU(i + 1, j, k)
                     + mV(i, j, k) - mV(i, j + 1, k)
@@ -831,49 +908,58 @@ void MACGrid::project(double dt)
         if(i == 0) {
             d(i, j, k) = d(i, j, k) + mU(i, j, k) * h_rho_by_dt;
         }
-        if(i == theDim[MACGrid::X]) {
+        if(i == mConfig.dim[MACGrid::X]) {
             d(i, j, k) = d(i, j, k) + mU(i + 1, j, k) * h_rho_by_dt;
         }
         if(j == 0) {
             d(i, j, k) = d(i, j, k) + mV(i, j, k) * h_rho_by_dt;
         }
-        if(j == theDim[MACGrid::Y]) {
+        if(j == mConfig.dim[MACGrid::Y]) {
             d(i, j, k) = d(i, j, k) + mV(i, j + 1, k) * h_rho_by_dt;
         }
         if(k == 0) {
             d(i, j, k) = d(i, j, k) + mW(i, j, k) * h_rho_by_dt;
         }
-        if(k == theDim[MACGrid::Z]) {
+        if(k == mConfig.dim[MACGrid::Z]) {
             d(i, j, k) = d(i, j, k) + mW(i, j, k + 1) * h_rho_by_dt;
         }
     }
 
     // Second, construct A, which is already computed using calculateAMatrix() function
     // Third, solve for p using preconditionedConjugateGradient() function
+    // The absolute tolerance is below what float fields can resolve on large
+    // right hand sides, so it never drops under the rounding level of d.
+    const double tolerance = std::max(0.000001, 16 * std::numeric_limits<Real>::epsilon() * GridKernels::maxMagnitude(d));
     if(useEigen)
-        useEigenComputeCG(target.mP, d, 100, 0.000001);
+        useEigenComputeCG(mP, d, 100, tolerance);
+    else if(thePressureSolver == MULTIGRIDSOLVER) {
+        calculateMultigrid();
+        if(!theWarmStart) GridKernels::fill(mP, 0.0);
+        mSolverIterations = mMultigrid.solve(mP, d, 100, tolerance, mSolverResidual);
+        PRINT_LINE("Multigrid: " << mSolverIterations << " V-cycles, residual " << mSolverResidual << ".");
+    }
     else
-        preconditionedConjugateGradient(AMatrix, target.mP, d, 500, 0.000001);
+        preconditionedConjugateGradient(AMatrix, mP, d, 500, tolerance);
 
     // Finally, subtract pressure from our velocity
     // u^(n+1)_i,j,k = u^_i,j,k - dt/(airDensity*h) * (P_i,j,k - P_i-1,j,k)
     //               = u^*_i,j,k - h * (mP_i,j,k - mP_i-1,j,k)
-    FOR_EACH_FACE {
+    PARALLEL_FOR_EACH_FACE_TILED {
         if(isValidFace(MACGrid::X, i, j, k)) {
-            if(i == 0 || i == theDim[MACGrid::X] || isBoxBoundaryFace(MACGrid::X, i, j, k)) target.mU(i, j, k) = 0;
-            else target.mU(i, j, k) = mU(i, j, k) - dt_by_h_rho * (target.mP(i, j, k) - target.mP(i-1, j, k));
+            if(mSolids.isWallFace(MACGrid::X, i, j, k)) mUNext(i, j, k) = 0;
+            else mUNext(i, j, k) = mU(i, j, k) - dt_by_h_rho * (mP(i, j, k) - mP(i-1, j, k));
         }
 
         if(isValidFace(MACGrid::Y, i, j, k)) {
-            if(j == 0 || j == theDim[MACGrid::Y] || isBoxBoundaryFace(MACGrid::Y, i, j, k)) target.mV(i, j, k) = 0;
-            else target.mV(i, j, k) = mV(i, j, k) - dt_by_h_rho * (target.mP(i, j, k) - target.mP(i, j-1, k));
+            if(mSolids.isWallFace(MACGrid::Y, i, j, k)) mVNext(i, j, k) = 0;
+            else mVNext(i, j, k) = mV(i, j, k) - dt_by_h_rho * (mP(i, j, k) - mP(i, j-1, k));
 
-            //if(target.mV(i, j, k) != 0) PRINT_LINE(target.mV(i, j, k));
+            //if(mVNext(i, j, k) != 0) PRINT_LINE(mVNext(i, j, k));
         }
 
         if(isValidFace(MACGrid::Z, i, j, k)) {
-            if(k == 0 || k == theDim[MACGrid::Z] || isBoxBoundaryFace(MACGrid::Z, i, j, k)) target.mW(i, j, k) = 0;
-            else target.mW(i, j, k) = mW(i, j, k) - dt_by_h_rho * (target.mP(i, j, k) - target.mP(i, j, k-1));
+            if(mSolids.isWallFace(MACGrid::Z, i, j, k)) mWNext(i, j, k) = 0;
+            else mWNext(i, j, k) = mW(i, j, k) - dt_by_h_rho * (mP(i, j, k) - mP(i, j, k-1));
         }
 
     }
@@ -886,16 +972,16 @@ void MACGrid::project(double dt)
 		if (isValidFace(MACGrid::X, i, j, k)) {
 
 			if (i == 0) {
-				if (abs(target.mU(i,j,k)) > 0.0000001) {
-					PRINT_LINE( "LOW X:  " << target.mU(i,j,k) );
-					//target.mU(i,j,k) = 0;
+				if (abs(mUNext(i,j,k)) > 0.0000001) {
+					PRINT_LINE( "LOW X:  " << mUNext(i,j,k) );
+					//mUNext(i,j,k) = 0;
 				}
 			}
 
-			if (i == theDim[MACGrid::X]) {
-				if (abs(target.mU(i,j,k)) > 0.0000001) {
-					PRINT_LINE( "HIGH X: " << target.mU(i,j,k) );
-					//target.mU(i,j,k) = 0;
+			if (i == mConfig.dim[MACGrid::X]) {
+				if (abs(mUNext(i,j,k)) > 0.0000001) {
+					PRINT_LINE( "HIGH X: " << mUNext(i,j,k) );
+					//mUNext(i,j,k) = 0;
 				}
 			}
 
@@ -904,16 +990,16 @@ void MACGrid::project(double dt)
 			
 
 			if (j == 0) {
-				if (abs(target.mV(i,j,k)) > 0.0000001) {
-					PRINT_LINE( "LOW Y:  " << target.mV(i,j,k) );
-					//target.mV(i,j,k) = 0;
+				if (abs(mVNext(i,j,k)) > 0.0000001) {
+					PRINT_LINE( "LOW Y:  " << mVNext(i,j,k) );
+					//mVNext(i,j,k) = 0;
 				}
 			}
 
-			if (j == theDim[MACGrid::Y]) {
-				if (abs(target.mV(i,j,k)) > 0.0000001) {
-					PRINT_LINE( "HIGH Y: " << target.mV(i,j,k) );
-					//target.mV(i,j,k) = 0;
+			if (j == mConfig.dim[MACGrid::Y]) {
+				if (abs(mVNext(i,j,k)) > 0.0000001) {
+					PRINT_LINE( "HIGH Y: " << mVNext(i,j,k) );
+					//mVNext(i,j,k) = 0;
 				}
 			}
 
@@ -921,16 +1007,16 @@ void MACGrid::project(double dt)
 		if (isValidFace(MACGrid::Z, i, j, k)) {
 			
 			if (k == 0) {
-				if (abs(target.mW(i,j,k)) > 0.0000001) {
-					PRINT_LINE( "LOW Z:  " << target.mW(i,j,k) );
-					//target.mW(i,j,k) = 0;
+				if (abs(mWNext(i,j,k)) > 0.0000001) {
+					PRINT_LINE( "LOW Z:  " << mWNext(i,j,k) );
+					//mWNext(i,j,k) = 0;
 				}
 			}
 
-			if (k == theDim[MACGrid::Z]) {
-				if (abs(target.mW(i,j,k)) > 0.0000001) {
-					PRINT_LINE( "HIGH Z: " << target.mW(i,j,k) );
-					//target.mW(i,j,k) = 0;
+			if (k == mConfig.dim[MACGrid::Z]) {
+				if (abs(mWNext(i,j,k)) > 0.0000001) {
+					PRINT_LINE( "HIGH Z: " << mWNext(i,j,k) );
+					//mWNext(i,j,k) = 0;
 				}
 			}
 		}
@@ -938,11 +1024,11 @@ void MACGrid::project(double dt)
 	#endif
 
 
-   // Then save the result to our object
-   mP = target.mP;
-   mU = target.mU;
-   mV = target.mV;
-   mW = target.mW;
+   // Then swap the result into our object
+   keepSolidFaces();
+   mU.swap(mUNext);
+   mV.swap(mVNext);
+   mW.swap(mWNext);
 
     #ifdef _DEBUG
    // IMPLEMENT THIS AS A SANITY CHECK: assert (checkDivergence());
@@ -955,7 +1041,7 @@ void MACGrid::project(double dt)
         double velHighY = mV(i,j+1,k);
         double velLowZ = mW(i,j,k);
         double velHighZ = mW(i,j,k+1);
-		double divergence = ((velHighX - velLowX) + (velHighY - velLowY) + (velHighZ - velLowZ)) / theCellSize;
+		double divergence = ((velHighX - velLowX) + (velHighY - velLowY) + (velHighZ - velLowZ)) / mConfig.cellSize;
 		if (abs(divergence) > 0.02 ) {
 			PRINT_LINE("WARNING: Divergent! ");
 			PRINT_LINE("Divergence: " << divergence);
@@ -976,6 +1062,20 @@ vec3 MACGrid::getVelocity(const vec3& pt)
    return vel;
 }
 
+void MACGrid::getVelocities(const vec3 points[], int count, vec3 velocities[])
+{
+   const int BATCH = 256;
+   const GridData* const components[] = { &mU, &mV, &mW };
+   double values[BATCH];
+   for (int first = 0; first < count; first += BATCH) {
+      const int n = std::min(BATCH, count - first);
+      for (int axis = 0; axis < 3; axis++) {
+         GridData::interpolate(&components[axis], 1, points + first, n, values);
+         for (int p = 0; p < n; p++) velocities[first + p][axis] = values[p];
+      }
+   }
+}
+
 double MACGrid::getVelocityX(const vec3& pt)
 {
    return mU.interpolate(pt);
@@ -1003,13 +1103,13 @@ double MACGrid::getDensity(const vec3& pt)
 
 vec3 MACGrid::getCenter(int i, int j, int k)
 {
-   double xstart = theCellSize/2.0;
-   double ystart = theCellSize/2.0;
-   double zstart = theCellSize/2.0;
+   double xstart = mConfig.cellSize/2.0;
+   double ystart = mConfig.cellSize/2.0;
+   double zstart = mConfig.cellSize/2.0;
 
-   double x = xstart + i*theCellSize;
-   double y = ystart + j*theCellSize;
-   double z = zstart + k*theCellSize;
+   double x = xstart + i*mConfig.cellSize;
+   double y = ystart + j*mConfig.cellSize;
+   double z = zstart + k*mConfig.cellSize;
    return vec3(x, y, z);
 }
 
@@ -1045,9 +1145,9 @@ vec3 MACGrid:: clipToGrid(const vec3& outsidePoint, const vec3& insidePoint) {
 	if (rewindPosition[0] < 0) rewindPosition[0] = 0; // TEMP!
 	if (rewindPosition[1] < 0) rewindPosition[1] = 0; // TEMP!
 	if (rewindPosition[2] < 0) rewindPosition[2] = 0; // TEMP!
-	if (rewindPosition[0] > theDim[MACGrid::X]) rewindPosition[0] = theDim[MACGrid::X]; // TEMP!
-	if (rewindPosition[1] > theDim[MACGrid::Y]) rewindPosition[1] = theDim[MACGrid::Y]; // TEMP!
-	if (rewindPosition[2] > theDim[MACGrid::Z]) rewindPosition[2] = theDim[MACGrid::Z]; // TEMP!
+	if (rewindPosition[0] > mConfig.dim[MACGrid::X]) rewindPosition[0] = mConfig.dim[MACGrid::X]; // TEMP!
+	if (rewindPosition[1] > mConfig.dim[MACGrid::Y]) rewindPosition[1] = mConfig.dim[MACGrid::Y]; // TEMP!
+	if (rewindPosition[2] > mConfig.dim[MACGrid::Z]) rewindPosition[2] = mConfig.dim[MACGrid::Z]; // TEMP!
 	return rewindPosition;
 	*/
 
@@ -1067,19 +1167,22 @@ vec3 MACGrid:: clipToGrid(const vec3& outsidePoint, const vec3& insidePoint) {
 			clippedPoint = insidePoint + distance * ratio;
 		}
 
-        // Linghan 2018-04-18. If point in box
-        if (clippedPoint[0] > boxMinPos && clippedPoint[0] < boxMaxPos &&
-            clippedPoint[1] > boxMinPos && clippedPoint[1] < boxMaxPos &&
-            clippedPoint[2] > boxMinPos && clippedPoint[2] < boxMaxPos) {
-            if (2 * clippedPoint[i] < (boxMaxPos + boxMinPos)) {
+        // Linghan 2018-04-18. If point in a solid: the solid cells it is in
+        // along each axis stand in for the box, which they are for a box.
+        double solidMin[3], solidMax[3];
+        if (mSolids.solidExtent(clippedPoint, solidMin, solidMax) &&
+            clippedPoint[0] > solidMin[0] && clippedPoint[0] < solidMax[0] &&
+            clippedPoint[1] > solidMin[1] && clippedPoint[1] < solidMax[1] &&
+            clippedPoint[2] > solidMin[2] && clippedPoint[2] < solidMax[2]) {
+            if (2 * clippedPoint[i] < (solidMax[i] + solidMin[i])) {
                 vec3 distance = clippedPoint - insidePoint;
-                double newDistanceI = boxMinPos - insidePoint[i];
+                double newDistanceI = solidMin[i] - insidePoint[i];
                 double ratio = newDistanceI / distance[i];
                 clippedPoint = insidePoint + distance * ratio;
             }
             else {
                 vec3 distance = clippedPoint - insidePoint;
-                double newDistanceI = boxMaxPos - insidePoint[i];
+                double newDistanceI = solidMax[i] - insidePoint[i];
                 double ratio = newDistanceI / distance[i];
                 clippedPoint = insidePoint + distance * ratio;
             }
@@ -1099,25 +1202,25 @@ vec3 MACGrid:: clipToGrid(const vec3& outsidePoint, const vec3& insidePoint) {
 
 
 double MACGrid::getSize(int dimension) {
-	return theDim[dimension] * theCellSize;
+	return mConfig.dim[dimension] * mConfig.cellSize;
 }
 
 
 int MACGrid::getCellIndex(int i, int j, int k)
 {
-	return i + j * theDim[MACGrid::X] + k * theDim[MACGrid::Y] * theDim[MACGrid::X];
+	return i + j * mConfig.dim[MACGrid::X] + k * mConfig.dim[MACGrid::Y] * mConfig.dim[MACGrid::X];
 }
 
 
 int MACGrid::getNumberOfCells()
 {
-	return theDim[MACGrid::X] * theDim[MACGrid::Y] * theDim[MACGrid::Z];
+	return mConfig.dim[MACGrid::X] * mConfig.dim[MACGrid::Y] * mConfig.dim[MACGrid::Z];
 }
 
 
 bool MACGrid::isValidCell(int i, int j, int k)
 {
-	if (i >= theDim[MACGrid::X] || j >= theDim[MACGrid::Y] || k >= theDim[MACGrid::Z]) {
+	if (i >= mConfig.dim[MACGrid::X] || j >= mConfig.dim[MACGrid::Y] || k >= mConfig.dim[MACGrid::Z]) {
 		return false;
 	}
 
@@ -1126,7 +1229,7 @@ bool MACGrid::isValidCell(int i, int j, int k)
 	}
 
     // Linghan 2018-04-18
-    if (isInBox(i, j, k)) {
+    if (mSolids.isSolid(i, j, k)) {
         return false;
     }
 
@@ -1134,80 +1237,53 @@ bool MACGrid::isValidCell(int i, int j, int k)
 }
 
 
-bool MACGrid::isValidFace(int dimension, int i, int j, int k)
+bool MACGrid::setSolids(const SolidMask& solids)
 {
-	if (dimension == 0) {
-		if (i > theDim[MACGrid::X] || j >= theDim[MACGrid::Y] || k >= theDim[MACGrid::Z]) {
-			return false;
-		}
-        // Linghan 2018-04-18
-        if (i > boxMin && i <= boxMax && j >= boxMin && j <= boxMax && k >= boxMin && k <= boxMax)
-            return false;
-
-	} else if (dimension == 1) {
-		if (i >= theDim[MACGrid::X] || j > theDim[MACGrid::Y] || k >= theDim[MACGrid::Z]) {
-			return false;
-		}
-        // Linghan 2018-04-18
-        if (i >= boxMin && i <= boxMax && j > boxMin && j <= boxMax && k >= boxMin && k <= boxMax)
-            return false;
-
-	} else if (dimension == 2) {
-		if (i >= theDim[MACGrid::X] || j >= theDim[MACGrid::Y] || k > theDim[MACGrid::Z]) {
-			return false;
-		}
-
-        // Linghan 2018-04-18
-        if (i >= boxMin && i <= boxMax && j >= boxMin && j <= boxMax && k > boxMin && k <= boxMax)
-            return false;
-	}
-
-	if (i < 0 || j < 0 || k < 0) {
-		return false;
-	}
+    for(int axis = 0; axis < 3; axis++) {
+        if(solids.dim(axis) != mConfig.dim[axis]) return false;
+    }
 
-	return true;
+    // No box: updateBox() would bring it back over the new solids.
+    boxMin = -1;
+    boxMax = -2;
+    mSolids = solids;
+    mSolids.update();
+    calculatePressureMatrix();
+    return true;
 }
 
-// Linghan 2018-04-18
-bool MACGrid::isInBox(int i, int j, int k)
+void MACGrid::setBoxSolids()
 {
-    if (i < boxMin) return false;
-    if (i > boxMax) return false;
-    if (j < boxMin) return false;
-    if (j > boxMax) return false;
-    if (k < boxMin) return false;
-    if (k > boxMax) return false;
-    return true;
+    const int lo[3] = { boxMin, boxMin, boxMin };
+    const int hi[3] = { boxMax + 1, boxMax + 1, boxMax + 1 };
+    mSolids.clear();
+    mSolids.addBox(lo, hi);
+    mSolids.update();
 }
 
-// Linghan 2018-04-18
-bool MACGrid::isBoxBoundaryFace(int dimension, int i, int j, int k)
+void MACGrid::keepSolidFaces()
 {
-    if (dimension == 0) {
-        if ((i == boxMin || i == boxMax+1) && j >= boxMin && j <= boxMax && k >= boxMin && k <= boxMax)
-            return true;
-
-    } else if (dimension == 1) {
-        if (i >= boxMin && i <= boxMax && (j == boxMin || j == boxMax+1) && k >= boxMin && k <= boxMax)
-            return true;
-
-    } else if (dimension == 2) {
-        if (i >= boxMin && i <= boxMax && j >= boxMin && j <= boxMax && (k == boxMin || k == boxMax+1))
-            return true;
-    }
-
-    return false;
+    // The face loops skip the faces inside solids (see isValidFace), which
+    // have to keep their current values when the scratch fields are swapped in.
+    const int* lo = mSolids.solidLo();
+    const int* hi = mSolids.solidHi();
+    for(int k = lo[2]; k <= hi[2]; k++)
+        for(int j = lo[1]; j <= hi[1]; j++)
+            for(int i = lo[0]; i <= hi[0]; i++) {
+                if(mSolids.isSolidFace(MACGrid::X, i, j, k)) mUNext(i, j, k) = mU(i, j, k);
+                if(mSolids.isSolidFace(MACGrid::Y, i, j, k)) mVNext(i, j, k) = mV(i, j, k);
+                if(mSolids.isSolidFace(MACGrid::Z, i, j, k)) mWNext(i, j, k) = mW(i, j, k);
+            }
 }
 
 vec3 MACGrid::getFacePosition(int dimension, int i, int j, int k)
 {
 	if (dimension == 0) {
-		return vec3(i * theCellSize, (j + 0.5) * theCellSize, (k + 0.5) * theCellSize);
+		return vec3(i * mConfig.cellSize, (j + 0.5) * mConfig.cellSize, (k + 0.5) * mConfig.cellSize);
 	} else if (dimension == 1) {
-		return vec3((i + 0.5) * theCellSize, j * theCellSize, (k + 0.5) * theCellSize);
+		return vec3((i + 0.5) * mConfig.cellSize, j * mConfig.cellSize, (k + 0.5) * mConfig.cellSize);
 	} else if (dimension == 2) {
-		return vec3((i + 0.5) * theCellSize, (j + 0.5) * theCellSize, k * theCellSize);
+		return vec3((i + 0.5) * mConfig.cellSize, (j + 0.5) * mConfig.cellSize, k * mConfig.cellSize);
 	}
 
 	return vec3(0,0,0); //???
@@ -1216,37 +1292,41 @@ vec3 MACGrid::getFacePosition(int dimension, int i, int j, int k)
 
 void MACGrid::calculateAMatrix() {
 
+    // Start from scratch, entries of previous solids must not survive.
+    AMatrix.initialize(mConfig);
+    mMultigrid.clear(); // Rebuilt from the new fluid cells on next use.
+
     // coefficients: self -> number of fluid neighbors;
     //      fluid neighbor -> -1; others -> 0
 	FOR_EACH_CELL {
         // Linghan 2018-04-18
-        if(isInBox(i, j, k)) {
+        if(mSolids.isSolid(i, j, k)) {
             AMatrix.diag(i,j,k) = 1;
             continue;
         }
 
 		int numFluidNeighbors = 0;
-		if (i-1 >= 0 && !isInBox(i-1, j, k)) {
+		if (i-1 >= 0 && !mSolids.isSolid(i-1, j, k)) {
 			AMatrix.plusI(i-1,j,k) = -1;
 			numFluidNeighbors++;
 		}
-		if (i+1 < theDim[MACGrid::X] && !isInBox(i+1, j, k)) {
+		if (i+1 < mConfig.dim[MACGrid::X] && !mSolids.isSolid(i+1, j, k)) {
 			AMatrix.plusI(i,j,k) = -1;
 			numFluidNeighbors++;
 		}
-		if (j-1 >= 0 && !isInBox(i, j-1, k)) {
+		if (j-1 >= 0 && !mSolids.isSolid(i, j-1, k)) {
 			AMatrix.plusJ(i,j-1,k) = -1;
 			numFluidNeighbors++;
 		}
-		if (j+1 < theDim[MACGrid::Y] && !isInBox(i, j+1, k)) {
+		if (j+1 < mConfig.dim[MACGrid::Y] && !mSolids.isSolid(i, j+1, k)) {
 			AMatrix.plusJ(i,j,k) = -1;
 			numFluidNeighbors++;
 		}
-		if (k-1 >= 0 && !isInBox(i, j, k-1)) {
+		if (k-1 >= 0 && !mSolids.isSolid(i, j, k-1)) {
 			AMatrix.plusK(i,j,k-1) = -1;
 			numFluidNeighbors++;
 		}
-		if (k+1 < theDim[MACGrid::Z] && !isInBox(i, j, k+1)) {
+		if (k+1 < mConfig.dim[MACGrid::Z] && !mSolids.isSolid(i, j, k+1)) {
 			AMatrix.plusK(i,j,k) = -1;
 			numFluidNeighbors++;
 		}
@@ -1259,74 +1339,65 @@ void MACGrid::calculateAMatrix() {
 
 bool MACGrid::preconditionedConjugateGradient(const GridDataMatrix & A, GridData & p, const GridData & d, int maxIterations, double tolerance) {
 	// Solves Ap = d for p.
-
-	FOR_EACH_CELL {
-		p(i,j,k) = 0.0; // Initial guess p = 0.	
+	// r, z and s are the preallocated workspace vectors; each step below is a
+	// single fused pass over memory.
+	GridData & r = mSolverR; // Residual vector.
+	GridData & z = mSolverZ; // Auxillary vector.
+	GridData & s = mSolverS; // Search vector;
+
+	if (thePreconditioner == MULTIGRID) calculateMultigrid();
+
+	if (theWarmStart) {
+		// Start from the p passed in, the pressure of the last frame.
+		double residual = GridKernels::residual(A, p, d, r); // r = d - Ap
+		if (residual <= tolerance) {
+			mSolverIterations = 0;
+			mSolverResidual = residual;
+			PRINT_LINE("PCG: warm start already within tolerance.");
+			return true;
+		}
 	}
-
-	GridData r = d; // Residual vector.
-
-    /*
-	PRINT_LINE("r: ");
-	FOR_EACH_CELL {
-		PRINT_LINE(r(i,j,k));
+	else {
+		GridKernels::fill(p, 0.0); // Initial guess p = 0.
+		r = d;
 	}
-    */
 
-	GridData z; z.initialize();
-	applyPreconditioner(r, A, z); // Auxillary vector.
-    /*
-	PRINT_LINE("z: ");
-	FOR_EACH_CELL {
-		PRINT_LINE(z(i,j,k));
-	}
-    */
+	GridKernels::fill(z, 0.0); // Solid cells must start (and stay) at 0.
+	applyPreconditioner(r, A, z);
 
-	GridData s = z; // Search vector;
+	s = z;
 
-	double sigma = dotProduct(z, r);
+	double sigma = GridKernels::dot(z, r);
 
 	for (int iteration = 0; iteration < maxIterations; iteration++) {
 
 		double rho = sigma; // According to TA. Here???
 
-		apply(A, s, z); // z = applyA(s);
-
-		double alpha = rho/dotProduct(z, s);
+		double alpha = rho / GridKernels::applyAndDot(A, s, z); // z = applyA(s);
 
-		GridData alphaTimesS; alphaTimesS.initialize();
-		multiply(alpha, s, alphaTimesS);
-		add(p, alphaTimesS, p);
-		//p += alpha * s;
-
-		GridData alphaTimesZ; alphaTimesZ.initialize();
-		multiply(alpha, z, alphaTimesZ);
-		subtract(r, alphaTimesZ, r);
-		//r -= alpha * z;
-
-		if (maxMagnitude(r) <= tolerance) {
-			PRINT_LINE("PCG converged in " << (iteration + 1) << " iterations.");
-            //PRINT_LINE("r: ");
-            //FOR_EACH_CELL {
-            //            PRINT_LINE(r(i,j,k)); }
+		double residual = GridKernels::updateSolution(alpha, s, z, p, r); // p += alpha * s; r -= alpha * z;
+		if (residual <= tolerance) {
+			mSolverIterations = iteration + 1;
+			mSolverResidual = residual;
+			static const char* preconditionerNames[] = { "", " (MIC0)", " (multigrid)" };
+			PRINT_LINE("PCG" << preconditionerNames[thePreconditioner] << " converged in " << mSolverIterations << " iterations.");
 			return true; //return p;
 		}
 
 		applyPreconditioner(r, A, z); // z = applyPreconditioner(r);
 
-		double sigmaNew = dotProduct(z, r);
+		double sigmaNew = GridKernels::dot(z, r);
 
 		double beta = sigmaNew / rho;
 
-		GridData betaTimesS; betaTimesS.initialize();
-		multiply(beta, s, betaTimesS);
-		add(z, betaTimesS, s);
-		//s = z + beta * s;
+		GridKernels::updateSearch(beta, z, s); // s = z + beta * s;
 
 		sigma = sigmaNew;
 	}
 
-	PRINT_LINE( "PCG didn't converge!" );
+	mSolverIterations = maxIterations;
+	mSolverResidual = GridKernels::maxMagnitude(r);
+	PRINT_LINE( "PCG didn't converge! Residual " << mSolverResidual << " after " << maxIterations << " iterations." );
 	return false;
 
 }
@@ -1334,24 +1405,37 @@ bool MACGrid::preconditionedConjugateGradient(const GridDataMatrix & A, GridData
 
 void MACGrid::calculatePreconditioner(const GridDataMatrix & A) {
 
-	precon.initialize();
+	precon.initialize(mConfig);
+	calculateWavefronts();
 
     double tao = 0.97;
 
-    // TODO: Build the modified incomplete Cholesky preconditioner following Fig 4.2 on page 36 of Bridson's 2007 SIGGRAPH fluid course notes.
-    //       This corresponds to filling in precon(i,j,k) for all cells
-    FOR_EACH_CELL {
-        if(!isInBox(i, j, k)) { // Linghan 2018-04-19
-            double e = A.diag(i, j, k) - pow((A.plusI(i - 1, j, k) * precon(i - 1, j, k)), 2)
-                       - pow((A.plusJ(i, j - 1, k) * precon(i, j - 1, k)), 2)
-                       - pow((A.plusK(i, j, k - 1) * precon(i, j, k - 1)), 2)
-                       - tao * (A.plusI(i - 1, j, k) * (A.plusJ(i - 1, j, k) + A.plusK(i - 1, j, k)) *
-                                pow(precon(i - 1, j, k), 2)
-                                + A.plusJ(i, j - 1, k) * (A.plusI(i, j - 1, k) + A.plusK(i, j - 1, k)) *
-                                  pow(precon(i, j - 1, k), 2)
-                                + A.plusK(i, j, k - 1) * (A.plusI(i, j, k - 1) + A.plusJ(i, j, k - 1)) *
-                                  pow(precon(i, j, k - 1), 2));
-            precon(i, j, k) = 1 / sqrt(e + pow(10, -30));
+    // Build the modified incomplete Cholesky preconditioner following Fig 4.2 on page 36 of Bridson's 2007 SIGGRAPH fluid course notes.
+    // precon(i,j,k) only depends on its i-1, j-1 and k-1 neighbors, so every
+    // cell of a wavefront can be filled in at the same time.
+    const Real* Adiag = A.diag.raw();
+    const Real* AplusI = A.plusI.raw();
+    const Real* AplusJ = A.plusJ.raw();
+    const Real* AplusK = A.plusK.raw();
+    Real* P = precon.raw();
+    const int sI = precon.strideI(), sJ = precon.strideJ(), sK = precon.strideK();
+    const int numWavefronts = mWavefrontStart.size() - 1;
+
+    PARALLEL_REGION
+    for (int w = 0; w < numWavefronts; w++) {
+        PARALLEL_FOR_IN_REGION
+        for (int c = mWavefrontStart[w]; c < mWavefrontStart[w + 1]; c++) {
+            int o = mWavefrontCells[c];
+            double e = Adiag[o] - pow((AplusI[o - sI] * P[o - sI]), 2)
+                       - pow((AplusJ[o - sJ] * P[o - sJ]), 2)
+                       - pow((AplusK[o - sK] * P[o - sK]), 2)
+                       - tao * (AplusI[o - sI] * (AplusJ[o - sI] + AplusK[o - sI]) *
+                                pow(P[o - sI], 2)
+                                + AplusJ[o - sJ] * (AplusI[o - sJ] + AplusK[o - sJ]) *
+                                  pow(P[o - sJ], 2)
+                                + AplusK[o - sK] * (AplusI[o - sK] + AplusJ[o - sK]) *
+                                  pow(P[o - sK], 2));
+            P[o] = 1 / sqrt(e + pow(10, -30));
         }
     }
 
@@ -1360,175 +1444,131 @@ void MACGrid::calculatePreconditioner(const GridDataMatrix & A) {
 }
 
 
-void MACGrid::applyPreconditioner(const GridData & r, const GridDataMatrix & A, GridData & z) {
+void MACGrid::calculateWavefronts() {
 
-    // TODO: change if(0) to if(1) after you implement calculatePreconditoner function.
-
-    if(0) {
-
-        // APPLY THE PRECONDITIONER:
-        // Solve Lq = r for q:
-        GridData q;
-        q.initialize();
-        FOR_EACH_CELL {
-                    //if (A.diag(i,j,k) != 0.0) { // If cell is a fluid.
-                    if(!isInBox(i, j, k)) { // Linghan 2018-04-19
-                        double t = r(i, j, k) - A.plusI(i - 1, j, k) * precon(i - 1, j, k) * q(i - 1, j, k)
-                                   - A.plusJ(i, j - 1, k) * precon(i, j - 1, k) * q(i, j - 1, k)
-                                   - A.plusK(i, j, k - 1) * precon(i, j, k - 1) * q(i, j, k - 1);
-                        q(i, j, k) = t * precon(i, j, k);
-                    }
-                    //}
-                }
-        // Solve L^Tz = q for z:
-        FOR_EACH_CELL_REVERSE {
-                    //if (A.diag(i,j,k) != 0.0) { // If cell is a fluid.
-                    if(!isInBox(i, j, k)) { // Linghan 2018-04-19
-                        double t = q(i, j, k) - A.plusI(i, j, k) * precon(i, j, k) * z(i + 1, j, k)
-                                   - A.plusJ(i, j, k) * precon(i, j, k) * z(i, j + 1, k)
-                                   - A.plusK(i, j, k) * precon(i, j, k) * z(i, j, k + 1);
-                        z(i, j, k) = t * precon(i, j, k);
-                    }
-                    //}
-                }
+    // Fluid cells on wavefront w satisfy i + j + k == w.
+    int numWavefronts = mConfig.dim[MACGrid::X] + mConfig.dim[MACGrid::Y] + mConfig.dim[MACGrid::Z] - 2;
+    mWavefrontStart.assign(numWavefronts + 1, 0);
+    FOR_EACH_CELL {
+        if(!mSolids.isSolid(i, j, k)) mWavefrontStart[i + j + k + 1]++;
     }
-    else{
-        // Unpreconditioned CG: Bypass preconditioner:
-        z = r;
-        return;
+    for (int w = 0; w < numWavefronts; w++) {
+        mWavefrontStart[w + 1] += mWavefrontStart[w];
     }
 
+    mWavefrontCells.resize(mWavefrontStart[numWavefronts]);
+    std::vector<int> next(mWavefrontStart.begin(), mWavefrontStart.end() - 1);
+    FOR_EACH_CELL {
+        if(!mSolids.isSolid(i, j, k)) mWavefrontCells[next[i + j + k]++] = precon.offset(i, j, k);
+    }
 }
 
 
+void MACGrid::calculateMultigrid() {
 
-double MACGrid::dotProduct(const GridData & vector1, const GridData & vector2) {
-	
-	double result = 0.0;
-
-	FOR_EACH_CELL {
-		result += vector1(i,j,k) * vector2(i,j,k);
-	}
-
-	return result;
-}
-
-
-void MACGrid::add(const GridData & vector1, const GridData & vector2, GridData & result) {
-	
-	FOR_EACH_CELL {
-		result(i,j,k) = vector1(i,j,k) + vector2(i,j,k);
-	}
-
-}
-
-
-void MACGrid::subtract(const GridData & vector1, const GridData & vector2, GridData & result) {
-	
-	FOR_EACH_CELL {
-		result(i,j,k) = vector1(i,j,k) - vector2(i,j,k);
-	}
-
-}
-
-
-void MACGrid::multiply(const double scalar, const GridData & vector, GridData & result) {
-	
-	FOR_EACH_CELL {
-		result(i,j,k) = scalar * vector(i,j,k);
-	}
+    if (mMultigrid.isSetup()) return;
 
+    // Same fluid cells as calculateAMatrix(), the solid cells act as walls.
+    std::vector<char> fluid(getNumberOfCells());
+    FOR_EACH_CELL {
+        fluid[getCellIndex(i, j, k)] = !mSolids.isSolid(i, j, k);
+    }
+    mMultigrid.setup(mConfig.dim, fluid);
 }
 
 
-double MACGrid::maxMagnitude(const GridData & vector) {
-	
-	double result = 0.0;
-
-	FOR_EACH_CELL {
-		if (abs(vector(i,j,k)) > result) result = abs(vector(i,j,k));
-	}
+void MACGrid::applyPreconditioner(const GridData & r, const GridDataMatrix & A, GridData & z) {
 
-	return result;
-}
+    if (thePreconditioner == NOPRECONDITIONER) {
+        // Unpreconditioned CG: Bypass preconditioner:
+        z = r;
+        return;
+    }
 
+    if (thePreconditioner == MULTIGRID) {
+        // MGPCG: one symmetric V-cycle approximates A^-1 r.
+        mMultigrid.applyVCycle(r, z);
+        return;
+    }
 
-void MACGrid::apply(const GridDataMatrix & matrix, const GridData & vector, GridData & result) {
-	
-	FOR_EACH_CELL { // For each row of the matrix.
-
-		double diag = 0;
-		double plusI = 0;
-		double plusJ = 0;
-		double plusK = 0;
-		double minusI = 0;
-		double minusJ = 0;
-		double minusK = 0;
-
-		diag = matrix.diag(i,j,k) * vector(i,j,k);
-		if (isValidCell(i+1,j,k)) plusI = matrix.plusI(i,j,k) * vector(i+1,j,k);
-		if (isValidCell(i,j+1,k)) plusJ = matrix.plusJ(i,j,k) * vector(i,j+1,k);
-		if (isValidCell(i,j,k+1)) plusK = matrix.plusK(i,j,k) * vector(i,j,k+1);
-		if (isValidCell(i-1,j,k)) minusI = matrix.plusI(i-1,j,k) * vector(i-1,j,k);
-		if (isValidCell(i,j-1,k)) minusJ = matrix.plusJ(i,j-1,k) * vector(i,j-1,k);
-		if (isValidCell(i,j,k-1)) minusK = matrix.plusK(i,j,k-1) * vector(i,j,k-1);
-
-		result(i,j,k) = diag + plusI + plusJ + plusK + minusI + minusJ + minusK;
-	}
+    // APPLY THE PRECONDITIONER:
+    GridData & q = mSolverQ;
+
+    const Real* AplusI = A.plusI.raw();
+    const Real* AplusJ = A.plusJ.raw();
+    const Real* AplusK = A.plusK.raw();
+    const Real* P = precon.raw();
+    const Real* R = r.raw();
+    Real* Q = q.raw();
+    Real* Z = z.raw();
+    const int sI = precon.strideI(), sJ = precon.strideJ(), sK = precon.strideK();
+    const int numWavefronts = mWavefrontStart.size() - 1;
+
+    PARALLEL_REGION
+    {
+        // Solve Lq = r for q, sweeping the wavefronts forward:
+        for (int w = 0; w < numWavefronts; w++) {
+            PARALLEL_FOR_IN_REGION
+            for (int c = mWavefrontStart[w]; c < mWavefrontStart[w + 1]; c++) {
+                int o = mWavefrontCells[c];
+                double t = R[o] - AplusI[o - sI] * P[o - sI] * Q[o - sI]
+                           - AplusJ[o - sJ] * P[o - sJ] * Q[o - sJ]
+                           - AplusK[o - sK] * P[o - sK] * Q[o - sK];
+                Q[o] = t * P[o];
+            }
+        }
+        // Solve L^Tz = q for z, sweeping the wavefronts backward:
+        for (int w = numWavefronts - 1; w >= 0; w--) {
+            PARALLEL_FOR_IN_REGION
+            for (int c = mWavefrontStart[w]; c < mWavefrontStart[w + 1]; c++) {
+                int o = mWavefrontCells[c];
+                double t = Q[o] - AplusI[o] * P[o] * Z[o + sI]
+                           - AplusJ[o] * P[o] * Z[o + sJ]
+                           - AplusK[o] * P[o] * Z[o + sK];
+                Z[o] = t * P[o];
+            }
+        }
+    }
 
 }
 
 void MACGrid::saveSmoke(const char* fileName) {
 	std::ofstream fileOut(fileName);
 	if (fileOut.is_open()) {
-		FOR_EACH_CELL {
-			fileOut << mD(i,j,k) << std::endl;
-		}
+		// One value per line, k slowest, as this format always was.
+		for (int k = 0; k < mConfig.dim[MACGrid::Z]; k++)
+			for (int j = 0; j < mConfig.dim[MACGrid::Y]; j++)
+				for (int i = 0; i < mConfig.dim[MACGrid::X]; i++)
+					fileOut << mD(i,j,k) << std::endl;
 		fileOut.close();
 	}
 }
 
 void MACGrid::saveParticle(std::string filename){
-	Partio::ParticlesDataMutable *parts = Partio::create();
-	Partio::ParticleAttribute posH, vH;
-	posH = parts->addAttribute("position", Partio::VECTOR, 3);
-	vH = parts->addAttribute("v", Partio::VECTOR, 3);
-	for (unsigned int i = 0; i < rendering_particles.size(); i++)
-	{
-		int idx = parts->addParticle();
-		float *p = parts->dataWrite<float>(posH, idx);
-		float *v = parts->dataWrite<float>(vH, idx);
-		for (int k = 0; k < 3; k++)
-		{
-			p[k] = rendering_particles[i][k];
-			v[k] = rendering_particles_vel[i][k];
-		}
-	}
-	
-	Partio::write(filename.c_str(), *parts);
-	parts->release();
+	CacheWriter::writeParticles(filename, rendering_particles);
 }
 
 void MACGrid::saveDensity(std::string filename){
-	Partio::ParticlesDataMutable *density_field = Partio::create();
-	Partio::ParticleAttribute posH, rhoH;
-	posH = density_field->addAttribute("position", Partio::VECTOR, 3);
-	rhoH = density_field->addAttribute("density", Partio::VECTOR, 1);
-	FOR_EACH_CELL{
-		int idx = density_field->addParticle();
-		float *p = density_field->dataWrite<float>(posH, idx);
-		float *rho = density_field->dataWrite<float>(rhoH, idx);
-		vec3 cellCenter = getCenter(i, j, k);
-		for (int l = 0; l < 3; l++)
-		{
-			p[l] = cellCenter[l];
-		}
-		rho[0] = getDensity(cellCenter);
-	}
-	Partio::write(filename.c_str(), *density_field);
-	density_field->release();
+	CacheWriter::writeDensity(filename, mD, mConfig, &mSmokeTiles);
+}
+
+void MACGrid::saveVolume(std::string filename){
+	VolumeFile::write(filename, mConfig, getVolumeChannels());
+}
+
+std::vector<VolumeFile::Channel> MACGrid::getVolumeChannels() const {
+	std::vector<VolumeFile::Channel> channels;
+	channels.push_back(VolumeFile::Channel("density", &mD));
+	channels.push_back(VolumeFile::Channel("temperature", &mT));
+	channels.push_back(VolumeFile::Channel("pressure", &mP));
+	channels.push_back(VolumeFile::Channel("velocity.x", &mU));
+	channels.push_back(VolumeFile::Channel("velocity.y", &mV));
+	channels.push_back(VolumeFile::Channel("velocity.z", &mW));
+	return channels;
 }
 
+#ifndef SMOKE_HEADLESS
+
 void MACGrid::draw(const Camera& c)
 {   
    drawWireGrid();
@@ -1549,7 +1589,7 @@ void MACGrid::drawVelocities()
          if (vel.Length() > 0.0001)
          {
            //vel.Normalize(); 
-           vel *= theCellSize/2.0;
+           vel *= mConfig.cellSize/2.0;
            vel += pos;
 		   glColor4f(1.0, 1.0, 0.0, 1.0);
            glVertex3dv(pos.n);
@@ -1593,21 +1633,21 @@ vec4 MACGrid::getRenderColor(const vec3& pt)
 void MACGrid::drawZSheets(bool backToFront)
 {
    // Draw K Sheets from back to front
-   double back =  (theDim[2])*theCellSize;
-   double top  =  (theDim[1])*theCellSize;
-   double right = (theDim[0])*theCellSize;
+   double back =  (mConfig.dim[2])*mConfig.cellSize;
+   double top  =  (mConfig.dim[1])*mConfig.cellSize;
+   double right = (mConfig.dim[0])*mConfig.cellSize;
   
-   double stepsize = theCellSize*0.25;
+   double stepsize = mConfig.cellSize*0.25;
 
    double startk = back - stepsize;
    double endk = 0;
-   double stepk = -theCellSize;
+   double stepk = -mConfig.cellSize;
 
    if (!backToFront)
    {
       startk = 0;
       endk = back;   
-      stepk = theCellSize;
+      stepk = mConfig.cellSize;
    }
 
    for (double k = startk; backToFront? k > endk : k < endk; k += stepk)
@@ -1656,21 +1696,21 @@ void MACGrid::drawZSheets(bool backToFront)
 void MACGrid::drawXSheets(bool backToFront)
 {
    // Draw K Sheets from back to front
-   double back =  (theDim[2])*theCellSize;
-   double top  =  (theDim[1])*theCellSize;
-   double right = (theDim[0])*theCellSize;
+   double back =  (mConfig.dim[2])*mConfig.cellSize;
+   double top  =  (mConfig.dim[1])*mConfig.cellSize;
+   double right = (mConfig.dim[0])*mConfig.cellSize;
   
-   double stepsize = theCellSize*0.25;
+   double stepsize = mConfig.cellSize*0.25;
 
    double starti = right - stepsize;
    double endi = 0;
-   double stepi = -theCellSize;
+   double stepi = -mConfig.cellSize;
 
    if (!backToFront)
    {
       starti = 0;
       endi = right;   
-      stepi = theCellSize;
+      stepi = mConfig.cellSize;
    }
 
    for (double i = starti; backToFront? i > endi : i < endi; i += stepi)
@@ -1761,18 +1801,18 @@ void MACGrid::drawWireGrid()
    double xstart = 0.0;
    double ystart = 0.0;
    double zstart = 0.0;
-   double xend = theDim[0]*theCellSize;
-   double yend = theDim[1]*theCellSize;
-   double zend = theDim[2]*theCellSize;
+   double xend = mConfig.dim[0]*mConfig.cellSize;
+   double yend = mConfig.dim[1]*mConfig.cellSize;
+   double zend = mConfig.dim[2]*mConfig.cellSize;
 
    glPushAttrib(GL_LIGHTING_BIT | GL_LINE_BIT);
       glDisable(GL_LIGHTING);
       glColor3f(0.25, 0.25, 0.25);
 
       glBegin(GL_LINES);
-      for (int i = 0; i <= theDim[0]; i++)
+      for (int i = 0; i <= mConfig.dim[0]; i++)
       {
-         double x = xstart + i*theCellSize;
+         double x = xstart + i*mConfig.cellSize;
          glVertex3d(x, ystart, zstart);
          glVertex3d(x, ystart, zend);
 
@@ -1780,9 +1820,9 @@ void MACGrid::drawWireGrid()
          glVertex3d(x, yend, zend);
       }
 
-      for (int i = 0; i <= theDim[2]; i++)
+      for (int i = 0; i <= mConfig.dim[2]; i++)
       {
-         double z = zstart + i*theCellSize;
+         double z = zstart + i*mConfig.cellSize;
          glVertex3d(xstart, ystart, z);
          glVertex3d(xend, ystart, z);
 
@@ -1813,7 +1853,7 @@ void MACGrid::drawFace(const MACGrid::Cube& cube)
    glColor4dv(cube.color.n);
    glPushMatrix();
       glTranslated(cube.pos[0], cube.pos[1], cube.pos[2]);      
-      glScaled(theCellSize, theCellSize, theCellSize);
+      glScaled(mConfig.cellSize, mConfig.cellSize, mConfig.cellSize);
       glBegin(GL_QUADS);
          glNormal3d( 0.0,  0.0, 1.0);
          glVertex3d(-LEN, -LEN, LEN);
@@ -1829,7 +1869,7 @@ void MACGrid::drawCube(const MACGrid::Cube& cube)
    glColor4dv(cube.color.n);
    glPushMatrix();
       glTranslated(cube.pos[0], cube.pos[1], cube.pos[2]);      
-      glScaled(theCellSize, theCellSize, theCellSize);
+      glScaled(mConfig.cellSize, mConfig.cellSize, mConfig.cellSize);
       glBegin(GL_QUADS);
          glNormal3d( 0.0, -1.0,  0.0);
          glVertex3d(-LEN, -LEN, -LEN);
@@ -1870,95 +1910,89 @@ void MACGrid::drawCube(const MACGrid::Cube& cube)
    glPopMatrix();
 }
 
+#endif // SMOKE_HEADLESS
+
 // Linghan 2018-04-19
 void MACGrid::calculateEigenAMatrix()
 {
-    index_map.clear();
-    int n = theDim[0] * theDim[1] * theDim[2] - pow((boxMax - boxMin + 1), 3);
-    AEigen = Eigen::SparseMatrix<double>(n, n);
-
-    // map (i, j, k) to index
-    int index = 0;
+    // Cells are numbered in FOR_EACH_CELL order, which is the storage order,
+    // so the neighbours along i, k and j are 1, nI and nI*nK cells away.
+    const int nI = mConfig.dim[MACGrid::X], nK = mConfig.dim[MACGrid::Z];
+    mEigenRow.assign(getNumberOfCells(), -1);
+    int n = 0, cell = 0;
     FOR_EACH_CELL {
-        if(!isInBox(i, j, k)) {
-            index_map.insert(make_pair(std::vector<int>{i, j, k}, index));
-            index++;
-        }
+        if(!mSolids.isSolid(i, j, k)) mEigenRow[cell] = n++;
+        cell++;
     }
 
+    std::vector<Eigen::Triplet<Real> > entries;
+    entries.reserve(7 * n);
+    cell = 0;
     FOR_EACH_CELL {
-        if(!isInBox(i, j, k)) {
-            int selfIdx = index_map.at(std::vector<int>{i, j, k});
+        const int self = mEigenRow[cell];
+        if(self >= 0) {
+            const bool fluid[6] = {
+                i-1 >= 0 && !mSolids.isSolid(i-1, j, k), i+1 < mConfig.dim[MACGrid::X] && !mSolids.isSolid(i+1, j, k),
+                j-1 >= 0 && !mSolids.isSolid(i, j-1, k), j+1 < mConfig.dim[MACGrid::Y] && !mSolids.isSolid(i, j+1, k),
+                k-1 >= 0 && !mSolids.isSolid(i, j, k-1), k+1 < mConfig.dim[MACGrid::Z] && !mSolids.isSolid(i, j, k+1) };
+            const int step[6] = { -1, 1, -nI*nK, nI*nK, -nI, nI };
             int numFluidNeighbors = 0;
-            if (i-1 >= 0 && !isInBox(i-1, j, k)) {
-                AEigen.insert(selfIdx, index_map.at(std::vector<int>{i-1, j, k})) = -1;
-                numFluidNeighbors++;
-            }
-            if (i+1 < theDim[MACGrid::X] && !isInBox(i+1, j, k)) {
-                AEigen.insert(selfIdx, index_map.at(std::vector<int>{i+1, j, k})) = -1;
-                numFluidNeighbors++;
-            }
-            if (j-1 >= 0 && !isInBox(i, j-1, k)) {
-                AEigen.insert(selfIdx, index_map.at(std::vector<int>{i, j-1, k})) = -1;
-                numFluidNeighbors++;
-            }
-            if (j+1 < theDim[MACGrid::Y] && !isInBox(i, j+1, k)) {
-                AEigen.insert(selfIdx, index_map.at(std::vector<int>{i, j+1, k})) = -1;
-                numFluidNeighbors++;
-            }
-            if (k-1 >= 0 && !isInBox(i, j, k-1)) {
-                AEigen.insert(selfIdx, index_map.at(std::vector<int>{i, j, k-1})) = -1;
-                numFluidNeighbors++;
-            }
-            if (k+1 < theDim[MACGrid::Z] && !isInBox(i, j, k+1)) {
-                AEigen.insert(selfIdx, index_map.at(std::vector<int>{i, j, k+1})) = -1;
+            for(int f = 0; f < 6; f++) {
+                if(!fluid[f]) continue;
+                entries.push_back(Eigen::Triplet<Real>(self, mEigenRow[cell + step[f]], -1));
                 numFluidNeighbors++;
             }
 
             // Set the diagonal:
-            AEigen.insert(selfIdx, selfIdx) = numFluidNeighbors;
+            entries.push_back(Eigen::Triplet<Real>(self, self, numFluidNeighbors));
         }
+        cell++;
     }
-    //std::cout << AEigen << std::endl;
-    std::cout << "finish compute AEigen" << std::endl;
+
+    AEigen.resize(n, n);
+    AEigen.setFromTriplets(entries.begin(), entries.end());
+    mEigenSolver.compute(AEigen);
+    mEigenP.setZero(n);
+    mEigenD.resize(n);
 }
 
 void MACGrid::useEigenComputeCG(GridData & p, const GridData & d, int maxIterations, double tolerance)
 {
-    int n = theDim[0] * theDim[1] * theDim[2] - pow((boxMax - boxMin + 1), 3);
-
-    Eigen::VectorXd vecp(n), vecd(n);
-
-    // fill in d
+    // fill in d, and p as the initial guess: the pressure of the last frame
+    // with theWarmStart, 0 otherwise
+    int cell = 0;
     FOR_EACH_CELL {
-        if(!isInBox(i, j, k)) {
-            vecd(index_map.at(std::vector<int>{i, j, k})) = d(i, j, k);
+        const int row = mEigenRow[cell++];
+        if(row >= 0) {
+            mEigenD(row) = d(i, j, k);
+            mEigenP(row) = theWarmStart ? p(i, j, k) : 0;
         }
     }
-    //std::cout << vecd << std::endl;
-
-    // compute
-    Eigen::ConjugateGradient<Eigen::SparseMatrix<double>, Eigen::Lower|Eigen::Upper, Eigen::IncompleteCholesky<double>> pcg;
-
-    pcg.compute(AEigen);
-    vecp = pcg.solve(vecd);
 
-    //std::cout << "#iterations:     " << pcg.iterations() << std::endl;
-    //std::cout << "estimated error: " << pcg.error()      << std::endl;
+    // Eigen stops on |r| <= tolerance * |d| in the 2-norm, which bounds the
+    // largest residual entry by the absolute tolerance the other solvers use.
+    const Real norm = mEigenD.norm();
+    Eigen::setNbThreads(Parallel::numThreads());
+    mEigenSolver.setMaxIterations(maxIterations);
+    mEigenSolver.setTolerance(norm > 0 ? tolerance / norm : 1);
+    mEigenP = mEigenSolver.solveWithGuess(mEigenD, mEigenP);
+    mSolverIterations = mEigenSolver.iterations();
+    mSolverResidual = mEigenSolver.error() * norm; // 2-norm, the others report the largest entry.
 
     // fill in p
+    cell = 0;
     FOR_EACH_CELL {
-        if(!isInBox(i, j, k)) {
-            p(i, j, k) = vecp(index_map.at(std::vector<int>{i, j, k}));
-        }
-        else p(i, j, k) = 0;
+        const int row = mEigenRow[cell++];
+        p(i, j, k) = row >= 0 ? mEigenP(row) : 0;
     }
 }
 
 void MACGrid::updateBox()
 {
+    if(boxMin > boxMax) return; // No box, e.g. after setSolids().
+
     if(boxUp) {
-        if(boxMax < theDim[0] - 1) {
+        if(boxMax < mConfig.dim[0] - 1) {
             boxMin += 1;
             boxMax += 1;
         }
@@ -1973,13 +2007,6 @@ void MACGrid::updateBox()
         else boxUp = true;
     }
 
-    boxMinPos = boxMin * theCellSize;
-    boxMaxPos = (boxMax + 1) * theCellSize;
-
-    if(useEigen)
-        calculateEigenAMatrix();
-    else {
-        calculateAMatrix();
-        calculatePreconditioner(AMatrix);
-    }
-}
\ No newline at end of file
+    setBoxSolids();
+    calculatePressureMatrix();
+}
\ No newline at end of file
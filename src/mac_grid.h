@@ -7,6 +7,15 @@
 #include "vec.h"
 #include "grid_data.h"
 #include "grid_data_matrix.h" 
+#include "grid_kernels.h"
+#include "multigrid.h"
+#include "volume_file.h"
+#include "checkpoint.h"
+#include "random.h"
+#include "tile_mask.h"
+#include "solid_mask.h"
+#include "particle_set.h"
+#include "emitter.h"
 #include <Partio.h>
 #include <Eigen/Dense>
 #include <Eigen/Sparse>
@@ -18,30 +27,57 @@ class MACGrid
 
 public:
 	MACGrid();
+	explicit MACGrid(const SimConfig& config);
 	~MACGrid();
-	MACGrid(const MACGrid& orig);
-	MACGrid& operator=(const MACGrid& orig);
 
 	void reset();
 
+	// Resizes the grid to config and resets it.
+	void initialize(const SimConfig& config);
+	const SimConfig& getConfig() const { return mConfig; }
+	const GridData& getDensityField() const { return mD; }
+	// Tiles where density or temperature is nonzero.
+	const TileMask& getSmokeTiles() const { return mSmokeTiles; }
+
+	// Sources of the scene, see emitter.h. Without any, updateSources() uses
+	// the built-in sources of theSourceType. Kept across reset().
+	void setEmitters(const std::vector<Emitter>& emitters) { mEmitters = emitters; }
+	const std::vector<Emitter>& getEmitters() const { return mEmitters; }
+
+	// Obstacles, see solid_mask.h. initialize() makes them the box, which
+	// setSolids() replaces with any voxelized geometry, for good: updateBox()
+	// no longer moves anything afterwards. Returns false, keeping the current
+	// solids, if solids was not sized for the cells of the current
+	// configuration. Saved in checkpoints.
+	bool setSolids(const SolidMask& solids);
+	const SolidMask& getSolids() const { return mSolids; }
+
 	void draw(const Camera& c);
-	void updateSources();
+	void updateSources(); // Once per frame, the emitters check their frame range.
 	void advectVelocity(double dt);
 	void addExternalForces(double dt);
 	void project(double dt);
 	void advectTemperature(double dt);
 	void advectDensity(double dt);
+	// Both in one pass, sharing the back-trace of every cell.
+	void advectDensityAndTemperature(double dt);
 	void advectRenderingParticles(double dt);
 
 protected:
 
 	// Setup
-	void initialize();
+	void calculatePressureMatrix(); // A and its preconditioner for the current solids.
 
 	// Simulation
 	void computeBuoyancy(double dt);
 	void computeVorticityConfinement(double dt);
 	void computeWind(); // Linghan
+	enum { MAX_CELL_FIELDS = 2 };
+	// Advects count <= MAX_CELL_FIELDS cell centered fields into next, sharing the back-traces.
+	void advectCellFields(double dt, GridData* const fields[], GridData* const next[], int count);
+	vec3 backTrace(const vec3& curPos, double dt); // Departure point of curPos, clipped to the grid.
+	int backTraceReach(double dt); // Tiles a back-trace and its stencil can reach.
+	void updateSmokeTiles(); // After every change of mD or mT.
 
 	// Rendering
 	struct Cube { vec3 pos; vec4 color; double dist; };
@@ -59,12 +95,16 @@ protected:
 	// GridData accessors
 	enum Direction { X, Y, Z };
 	vec3 getVelocity(const vec3& pt);
+	// Batched getVelocity(), each component sampled for all points in one pass.
+	void getVelocities(const vec3 points[], int count, vec3 velocities[]);
 	double getVelocityX(const vec3& pt);
 	double getVelocityY(const vec3& pt);
 	double getVelocityZ(const vec3& pt);
 	double getTemperature(const vec3& pt);
 	double getDensity(const vec3& pt);
 	vec3 getCenter(int i, int j, int k);
+	// Adds particlesPerCell jittered particles to each of cells (getCellIndex()) of emitter source.
+	void emitParticles(const std::vector<int>& cells, int particlesPerCell, int source);
 
 	
 	vec3 getRewoundPosition(const vec3 & currentPosition, const double dt);
@@ -73,20 +113,19 @@ protected:
 	int getCellIndex(int i, int j, int k);
 	int getNumberOfCells();
 	bool isValidCell(int i, int j, int k);
-	bool isValidFace(int dimension, int i, int j, int k);
+	// Faces inside solids and beyond the grid are not simulated.
+	bool isValidFace(int dimension, int i, int j, int k) const { return mSolids.isValidFace(dimension, i, j, k); }
 	vec3 getFacePosition(int dimension, int i, int j, int k);
 	void calculateAMatrix();
 	bool preconditionedConjugateGradient(const GridDataMatrix & A, GridData & p, const GridData & d, int maxIterations, double tolerance);
 	void calculatePreconditioner(const GridDataMatrix & A);
 	void applyPreconditioner(const GridData & r, const GridDataMatrix & A, GridData & z);
-	double dotProduct(const GridData & vector1, const GridData & vector2);
-	void add(const GridData & vector1, const GridData & vector2, GridData & result);
-	void subtract(const GridData & vector1, const GridData & vector2, GridData & result);
-	void multiply(const double scalar, const GridData & vector, GridData & result);
-	double maxMagnitude(const GridData & vector);
-	void apply(const GridDataMatrix & matrix, const GridData & vector, GridData & result);
+	void calculateWavefronts();
+	void calculateMultigrid();
 
 
+	SimConfig mConfig;
+
 	GridDataX mU; // X component of velocity, stored on X faces, size is (dimX+1)*dimY*dimZ
 	GridDataY mV; // Y component of velocity, stored on Y faces, size is dimX*(dimY+1)*dimZ
 	GridDataZ mW; // W component of velocity, stored on Z faces, size is dimX*dimY*(dimZ+1)
@@ -94,34 +133,83 @@ protected:
 	GridData mD;  // Density, stored at grid centers, size is dimX*dimY*dimZ
 	GridData mT;  // Temperature, stored at grid centers, size is dimX*dimY*dimZ
 
+	// Scratch fields the passes write their result into before swapping it
+	// with the field they update, so no pass copies a whole field.
+	GridDataX mUNext;
+	GridDataY mVNext;
+	GridDataZ mWNext;
+	GridData mDNext;
+	GridData mTNext;
+
+	// Tiles of nonzero density or temperature, and scratch for the tiles
+	// within reach of them. Density and temperature are exactly 0 everywhere
+	// else, so advection, buoyancy and the density output skip those tiles.
+	TileMask mSmokeTiles;
+	TileMask mReachTiles;
+
+	// Solid and fluid cells and the type of every face. Rebuilt when the
+	// obstacles change, the passes only look them up.
+	SolidMask mSolids;
+
 	
 	GridDataMatrix AMatrix;
 	GridData precon;
 
+	// Fluid cells grouped by i+j+k, as storage offsets. Cells on one wavefront
+	// do not depend on each other in the MIC(0) factorization and triangular
+	// solves, so each wavefront is processed in parallel.
+	std::vector<int> mWavefrontCells;
+	std::vector<int> mWavefrontStart;
+
+	// PCG workspace, allocated once per grid size in reset() and reused by
+	// every solve: residual, auxiliary, search and preconditioner temp vectors.
+	GridData mSolverR;
+	GridData mSolverZ;
+	GridData mSolverS;
+	GridData mSolverQ;
+
+	// Multigrid hierarchy for the MULTIGRID preconditioner and solver. Built on
+	// first use after the A matrix changes.
+	MultigridSolver mMultigrid;
+
+	// Calls of updateSources() since the last reset, the frame the emitters
+	// see; also keys the jitter of the particles emitted. Part of the
+	// checkpointed state.
+	uint64_t mSourceFrame;
+
+	std::vector<Emitter> mEmitters;
+	std::vector<int> mSourceCells; // Cells of the emitter being rasterized.
+
+	// Statistics of the last pressure solve.
+	int mSolverIterations = 0;
+	double mSolverResidual = 0.0;
+
 	// Linghan 2018-04-18
     bool useEigen = false;
 
-	int boxMin = 16; int boxMax = 48; // if set boxMin = -1, boxMax = -2, no box
-	//int boxMin = 10, boxMax = 22;
-    //int boxMin = 6, boxMax = 12;
-	//int boxMin = -1, boxMax = -2;
-	double boxMinPos = boxMin * theCellSize;
-	double boxMaxPos = (boxMax + 1) * theCellSize;
+	// Set from the grid size in initialize(). If set boxMin = -1, boxMax = -2, no box
+	int boxMin = -1; int boxMax = -2;
     bool boxUp = true;
 
-	bool isInBox(int i, int j, int k);
-    bool isBoxBoundaryFace(int dimension, int i, int j, int k);
+    void setBoxSolids(); // Makes mSolids the cells of the box.
+    void keepSolidFaces(); // Copies the faces inside solids into mUNext, mVNext and mWNext.
 
-	Eigen::SparseMatrix<double> AEigen;
-	std::map <std::vector<int>, int> index_map;
+	// Eigen pressure path. A and its incomplete Cholesky factorization are
+	// only rebuilt by calculatePressureMatrix(), when the fluid cells change.
+	// Row major, so Eigen multiplies by A on Parallel::numThreads() threads.
+	typedef Eigen::SparseMatrix<Real, Eigen::RowMajor> EigenMatrix;
+	typedef Eigen::Matrix<Real, Eigen::Dynamic, 1> EigenVector;
+	EigenMatrix AEigen;
+	Eigen::ConjugateGradient<EigenMatrix, Eigen::Lower|Eigen::Upper, Eigen::IncompleteCholesky<Real> > mEigenSolver;
+	EigenVector mEigenP, mEigenD;
+	std::vector<int> mEigenRow; // Row of every cell in FOR_EACH_CELL order, -1 in solids.
 	void calculateEigenAMatrix();
     void useEigenComputeCG(GridData & p, const GridData & d, int maxIterations, double tolerance);
 
 public:
 
 	// rendering particles
-	std::vector<vec3> rendering_particles;
-	std::vector<vec3> rendering_particles_vel;
+	ParticleSet rendering_particles;
 
 	enum RenderMode { CUBES, SHEETS };
 	static RenderMode theRenderMode;
@@ -133,10 +221,41 @@ public:
 
     enum SourceType { INIT, CUBECENTER, TWOSOURCE };
     static SourceType theSourceType;
+
+	enum Preconditioner { NOPRECONDITIONER, MIC0, MULTIGRID };
+	static Preconditioner thePreconditioner;
+
+	// PCGSOLVER runs PCG with thePreconditioner, MULTIGRIDSOLVER runs plain
+	// V-cycles. Ignored when useEigen is set.
+	enum PressureSolver { PCGSOLVER, MULTIGRIDSOLVER };
+	static PressureSolver thePressureSolver;
+
+	// Density and temperature tiles that stay below this magnitude are
+	// cleared and dropped from mSmokeTiles. This removes the faint tails the
+	// cubic stencil leaves behind, which would otherwise spread over the whole
+	// grid within a few dozen frames. 0 keeps every value.
+	static double theSmokeCutoff;
+
+	// Seeds every pressure solver with the pressure of the last frame instead
+	// of 0. A slowly changing plume then starts close to the solution.
+	static bool theWarmStart;
+
+	int getSolverIterations() const { return mSolverIterations; }
+	double getSolverResidual() const { return mSolverResidual; }
 	
 	void saveSmoke(const char* fileName);
 	void saveParticle(std::string filename);
 	void saveDensity(std::string filename);
+	void saveVolume(std::string filename);
+
+	// Full simulation state for checkpoints: configuration, box, fields,
+	// particles and random number state. loadState() resizes the grid to the
+	// stored configuration; on failure it is left reset and returns false.
+	void saveState(CheckpointWriter& out) const;
+	bool loadState(CheckpointReader& in);
+
+	// Fields stored in .vol caches, see volume_file.h.
+	std::vector<VolumeFile::Channel> getVolumeChannels() const;
 
     void updateBox();
 };
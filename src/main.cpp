@@ -6,7 +6,10 @@
 #include <cmath> 
 #include "open_gl_headers.h" 
 #include "basic_math.h"
+#include "parallel.h"
+#include "custom_output.h"
 #include <string.h>
+#include <stdlib.h>
 
 // Geometry and whatnot
 SmokeSim theSmokeSim;
@@ -26,9 +29,10 @@ int savedHeight = 0;
 
 void initCamera()
 {
-   double w = theDim[0]*theCellSize;   
-   double h = theDim[1]*theCellSize;   
-   double d = theDim[2]*theCellSize;   
+   const SimConfig& config = theSmokeSim.getConfig();
+   double w = config.dim[0]*config.cellSize;   
+   double h = config.dim[1]*config.cellSize;   
+   double d = config.dim[2]*config.cellSize;   
    double angle = 0.5*theCamera.dfltVfov*BasicMath::PI/180.0;
    double dist;
    if (w > h) dist = w*0.5/std::tan(angle);  // aspect is 1, so i can do this
@@ -105,6 +109,28 @@ void onKeyboardCb(unsigned char key, int x, int y)
    else if (key == '>') isRunning = true;
    else if (key == '=') isRunning = false;
    else if (key == '<') theSmokeSim.reset();
+   else if (key == 't')
+   {
+      Parallel::setNumThreads(Parallel::numThreads() > 1 ? 1 : 0);
+      PRINT_LINE("Simulating with " << Parallel::numThreads() << " thread(s).");
+   }
+   else if (key == 'p')
+   {
+      // Cycle none -> MIC(0) -> multigrid.
+      MACGrid::thePreconditioner = (MACGrid::Preconditioner) ((MACGrid::thePreconditioner + 1) % 3);
+      static const char* names[] = { "none", "MIC(0)", "multigrid" };
+      PRINT_LINE("Preconditioner: " << names[MACGrid::thePreconditioner] << ".");
+   }
+   else if (key == 'g')
+   {
+      MACGrid::thePressureSolver = MACGrid::thePressureSolver == MACGrid::PCGSOLVER ? MACGrid::MULTIGRIDSOLVER : MACGrid::PCGSOLVER;
+      PRINT_LINE("Pressure solver: " << (MACGrid::thePressureSolver == MACGrid::PCGSOLVER ? "PCG." : "multigrid V-cycles."));
+   }
+   else if (key == 'w')
+   {
+      MACGrid::theWarmStart = !MACGrid::theWarmStart;
+      PRINT_LINE("Pressure warm start: " << (MACGrid::theWarmStart ? "on." : "off."));
+   }
    else if (key == 27) exit(0); // ESC Key
    glutPostRedisplay();
 }
@@ -208,6 +234,16 @@ void init(void)
 int main(int argc, char **argv)
 {
     glutInit(&argc, argv);
+
+    // Optional grid size: SMOKE [dimX dimY dimZ]
+    if (argc == 4) theSmokeSim.setGridDimensions(atoi(argv[1]), atoi(argv[2]), atoi(argv[3]));
+    // SMOKE_PROFILE=<file.csv|file.json> times every frame, see profiler.h.
+    if (const char* profile = getenv("SMOKE_PROFILE")) theSmokeSim.setProfileOutput(profile);
+    // SMOKE_SCENE=<file> takes the smoke sources from a scene file, see emitter.h.
+    if (const char* scene = getenv("SMOKE_SCENE")) theSmokeSim.loadScene(scene);
+    // SMOKE_WARM_START=1 seeds the pressure solve with the last frame's pressure.
+    if (const char* warm = getenv("SMOKE_WARM_START")) MACGrid::theWarmStart = atoi(warm) != 0;
+
     glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA | GLUT_DEPTH);
     glutInitWindowSize(640, 480);
     glutInitWindowPosition(100, 100);
@@ -230,6 +266,10 @@ int main(int argc, char **argv)
     glutAddMenuEntry("Pause\t'='", '=');
     glutAddMenuEntry("Reset\t'<'", '<');
     glutAddMenuEntry("Reset camera\t' '", ' ');
+    glutAddMenuEntry("Toggle multithreading\t't'", 't');
+    glutAddMenuEntry("Cycle preconditioner\t'p'", 'p');
+    glutAddMenuEntry("Toggle multigrid solver\t'g'", 'g');
+    glutAddMenuEntry("Toggle pressure warm start\t'w'", 'w');
     glutAddMenuEntry("Record\t'r'", 'r');
     glutAddSubMenu("Display", viewMenu);
     glutAddMenuEntry("_________________", -1);
@@ -0,0 +1,295 @@
+#include "multigrid.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+	// Stop coarsening once a level is this small along any axis.
+	const int COARSEST_DIM = 4;
+
+}
+
+MultigridSolver::MultigridSolver() :
+	mPreSmoothing(2), mPostSmoothing(2), mCoarsestSweeps(16)
+{
+}
+
+void MultigridSolver::setup(const int dim[3], const std::vector<char>& fluid)
+{
+	mLevels.clear();
+
+	int n[3] = { dim[0], dim[1], dim[2] };
+	for (;;) {
+		mLevels.push_back(Level());
+		Level& level = mLevels.back();
+		for (int a = 0; a < 3; a++) level.n[a] = n[a];
+		level.strideJ = n[0] + 2;
+		level.strideK = (n[0] + 2) * (n[1] + 2);
+		const int size = level.strideK * (n[2] + 2);
+		level.x.assign(size, 0.0);
+		level.b.assign(size, 0.0);
+		level.r.assign(size, 0.0);
+		level.mask.assign(size, 0.0);
+
+		if (std::min(n[0], std::min(n[1], n[2])) < 2 * COARSEST_DIM) break;
+		for (int a = 0; a < 3; a++) n[a] = (n[a] + 1) / 2;
+	}
+
+	// Fluid masks, finest level from the caller and each coarse cell fluid if any child is.
+	Level& finest = mLevels[0];
+	for (int k = 0; k < dim[2]; k++)
+		for (int j = 0; j < dim[1]; j++)
+			for (int i = 0; i < dim[0]; i++)
+				finest.mask[finest.offset(i, j, k)] = fluid[i + dim[0] * (j + dim[1] * k)] ? 1.0 : 0.0;
+
+	for (int l = 1; l < numLevels(); l++) {
+		const Level& fine = mLevels[l - 1];
+		Level& coarse = mLevels[l];
+		for (int k = 0; k < fine.n[2]; k++)
+			for (int j = 0; j < fine.n[1]; j++)
+				for (int i = 0; i < fine.n[0]; i++)
+					if (fine.mask[fine.offset(i, j, k)] != 0.0)
+						coarse.mask[coarse.offset(i / 2, j / 2, k / 2)] = 1.0;
+	}
+
+	// Diagonal of the 7-point Laplacian: the number of fluid neighbors.
+	// The padding is never fluid, so the domain boundary needs no special case.
+	for (int l = 0; l < numLevels(); l++) {
+		Level& level = mLevels[l];
+		const int sJ = level.strideJ, sK = level.strideK;
+		const std::vector<Real>& m = level.mask;
+		level.diag.assign(m.size(), 0.0);
+		level.invDiag.assign(m.size(), 0.0);
+		for (int k = 0; k < level.n[2]; k++)
+			for (int j = 0; j < level.n[1]; j++)
+				for (int i = 0; i < level.n[0]; i++) {
+					int o = level.offset(i, j, k);
+					if (m[o] == 0.0) continue;
+					double count = m[o - 1] + m[o + 1] + m[o - sJ] + m[o + sJ] + m[o - sK] + m[o + sK];
+					level.diag[o] = count;
+					level.invDiag[o] = count > 0.0 ? 1.0 / count : 0.0;
+				}
+	}
+}
+
+void MultigridSolver::applyVCycle(const GridData& r, GridData& z)
+{
+	Level& finest = mLevels[0];
+	loadLevel0(r, finest.b);
+	std::fill(finest.x.begin(), finest.x.end(), 0.0);
+	vcycle(0);
+	storeLevel0(finest.x, z);
+}
+
+int MultigridSolver::solve(GridData& p, const GridData& d, int maxCycles, double tolerance, double& residual)
+{
+	Level& finest = mLevels[0];
+	loadLevel0(d, finest.b);
+	loadLevel0(p, finest.x);
+
+	int cycle = 0;
+	residual = computeResidual(finest);
+	while (residual > tolerance && cycle < maxCycles) {
+		vcycle(0);
+		residual = computeResidual(finest);
+		cycle++;
+	}
+
+	storeLevel0(finest.x, p);
+	return cycle;
+}
+
+void MultigridSolver::vcycle(int l)
+{
+	Level& level = mLevels[l];
+
+	if (l == numLevels() - 1) {
+		for (int s = 0; s < mCoarsestSweeps; s++) { smooth(level, 0); smooth(level, 1); }
+		for (int s = 0; s < mCoarsestSweeps; s++) { smooth(level, 1); smooth(level, 0); }
+		return;
+	}
+
+	for (int s = 0; s < mPreSmoothing; s++) { smooth(level, 0); smooth(level, 1); }
+
+	computeResidual(level);
+	Level& coarse = mLevels[l + 1];
+	restrictResidual(level, coarse);
+	std::fill(coarse.x.begin(), coarse.x.end(), 0.0);
+	vcycle(l + 1);
+	prolongateCorrection(coarse, level);
+
+	for (int s = 0; s < mPostSmoothing; s++) { smooth(level, 1); smooth(level, 0); }
+}
+
+void MultigridSolver::smooth(Level& level, int color)
+{
+	// Gauss-Seidel on the cells with (i+j+k)%2 == color. Their neighbors all
+	// have the other color, so the update order within a sweep does not matter.
+	const int sJ = level.strideJ, sK = level.strideK;
+	const int nI = level.n[0], nJ = level.n[1], nK = level.n[2];
+	Real* X = &level.x[0];
+	const Real* B = &level.b[0];
+	const Real* invDiag = &level.invDiag[0];
+
+	PARALLEL_FOR
+	for (int k = 0; k < nK; k++) {
+		for (int j = 0; j < nJ; j++) {
+			const int row = level.offset(0, j, k);
+			for (int i = (color + j + k) & 1; i < nI; i += 2) {
+				const int o = row + i;
+				// Solids and the padding keep x = 0, so their terms drop out.
+				X[o] = (B[o] + X[o - 1] + X[o + 1] + X[o - sJ] + X[o + sJ] + X[o - sK] + X[o + sK]) * invDiag[o];
+			}
+		}
+	}
+}
+
+double MultigridSolver::computeResidual(Level& level)
+{
+	// r = b - Ax on fluid cells, 0 elsewhere. Returns max|r|.
+	const int sJ = level.strideJ, sK = level.strideK;
+	const int nI = level.n[0], nJ = level.n[1], nK = level.n[2];
+	const Real* X = &level.x[0];
+	const Real* B = &level.b[0];
+	const Real* diag = &level.diag[0];
+	const Real* mask = &level.mask[0];
+	Real* R = &level.r[0];
+	std::vector<double> partial(nK, 0.0);
+
+	PARALLEL_FOR
+	for (int k = 0; k < nK; k++) {
+		Real result = 0.0;
+		for (int j = 0; j < nJ; j++) {
+			const int row = level.offset(0, j, k);
+			SIMD_REDUCTION(max, result)
+			for (int o = row; o < row + nI; o++) {
+				Real ax = diag[o] * X[o] - (X[o - 1] + X[o + 1] + X[o - sJ] + X[o + sJ] + X[o - sK] + X[o + sK]);
+				R[o] = mask[o] * (B[o] - ax);
+				result = std::max(result, std::fabs(R[o]));
+			}
+		}
+		partial[k] = result;
+	}
+
+	return *std::max_element(partial.begin(), partial.end());
+}
+
+namespace {
+
+	// 1D trilinear prolongation: fine cell f takes 3/4 of its parent f/2 and
+	// 1/4 of the parent's neighbor on f's side. The neighbor index is clamped
+	// to the grid, so at the domain boundary the parent gets the full weight.
+	void parents(int f, int nc, int c[2], double w[2])
+	{
+		c[0] = f / 2;
+		c[1] = std::min(std::max((f & 1) ? c[0] + 1 : c[0] - 1, 0), nc - 1);
+		w[0] = 0.75;
+		w[1] = 0.25;
+	}
+
+	// Weight of fine cell f in P's column for coarse cell c.
+	double prolongationWeight(int f, int c, int nc)
+	{
+		int pc[2]; double pw[2];
+		parents(f, nc, pc, pw);
+		return (pc[0] == c ? pw[0] : 0.0) + (pc[1] == c ? pw[1] : 0.0);
+	}
+
+}
+
+void MultigridSolver::restrictResidual(const Level& fine, Level& coarse)
+{
+	// b_c = 4 * R r_f with R = P^T / 8: the factor 4 rescales the unscaled
+	// Laplacian to the doubled cell size. Fine cells 2c-1 .. 2c+2 along each
+	// axis can have coarse cell c as a parent.
+	const Real* R = &fine.r[0];
+	const Real* mask = &coarse.mask[0];
+	Real* B = &coarse.b[0];
+	const int nI = coarse.n[0], nJ = coarse.n[1], nK = coarse.n[2];
+
+	PARALLEL_FOR
+	for (int k = 0; k < nK; k++) {
+		for (int j = 0; j < nJ; j++) {
+			for (int i = 0; i < nI; i++) {
+				const int o = coarse.offset(i, j, k);
+				if (mask[o] == 0.0) { B[o] = 0.0; continue; }
+
+				double sum = 0.0;
+				for (int fk = 2 * k - 1; fk <= 2 * k + 2; fk++) {
+					if (fk < 0 || fk >= fine.n[2]) continue;
+					double wk = prolongationWeight(fk, k, nK);
+					if (wk == 0.0) continue;
+					for (int fj = 2 * j - 1; fj <= 2 * j + 2; fj++) {
+						if (fj < 0 || fj >= fine.n[1]) continue;
+						double wjk = wk * prolongationWeight(fj, j, nJ);
+						if (wjk == 0.0) continue;
+						for (int fi = 2 * i - 1; fi <= 2 * i + 2; fi++) {
+							if (fi < 0 || fi >= fine.n[0]) continue;
+							sum += wjk * prolongationWeight(fi, i, nI) * R[fine.offset(fi, fj, fk)];
+						}
+					}
+				}
+				B[o] = 0.5 * sum;
+			}
+		}
+	}
+}
+
+void MultigridSolver::prolongateCorrection(const Level& coarse, Level& fine)
+{
+	// x_f += P x_c on fluid cells. Coarse solids hold x = 0.
+	const Real* XC = &coarse.x[0];
+	const Real* mask = &fine.mask[0];
+	Real* X = &fine.x[0];
+	const int nI = fine.n[0], nJ = fine.n[1], nK = fine.n[2];
+
+	PARALLEL_FOR
+	for (int k = 0; k < nK; k++) {
+		int ck[2]; double wk[2];
+		parents(k, coarse.n[2], ck, wk);
+		for (int j = 0; j < nJ; j++) {
+			int cj[2]; double wj[2];
+			parents(j, coarse.n[1], cj, wj);
+			for (int i = 0; i < nI; i++) {
+				const int o = fine.offset(i, j, k);
+				if (mask[o] == 0.0) continue;
+				int ci[2]; double wi[2];
+				parents(i, coarse.n[0], ci, wi);
+
+				double sum = 0.0;
+				for (int c = 0; c < 2; c++)
+					for (int b = 0; b < 2; b++)
+						for (int a = 0; a < 2; a++)
+							sum += wk[c] * wj[b] * wi[a] * XC[coarse.offset(ci[a], cj[b], ck[c])];
+				X[o] += sum;
+			}
+		}
+	}
+}
+
+void MultigridSolver::loadLevel0(const GridData& src, std::vector<Real>& dst) const
+{
+	const Level& finest = mLevels[0];
+	const Real* S = src.raw();
+
+	PARALLEL_FOR
+	for (int k = 0; k < finest.n[2]; k++)
+		for (int j = 0; j < finest.n[1]; j++)
+			for (int i = 0; i < finest.n[0]; i++) {
+				const int o = finest.offset(i, j, k);
+				dst[o] = finest.mask[o] * S[src.offset(i, j, k)];
+			}
+}
+
+void MultigridSolver::storeLevel0(const std::vector<Real>& src, GridData& dst) const
+{
+	const Level& finest = mLevels[0];
+	Real* D = dst.raw();
+
+	PARALLEL_FOR
+	for (int k = 0; k < finest.n[2]; k++)
+		for (int j = 0; j < finest.n[1]; j++)
+			for (int i = 0; i < finest.n[0]; i++)
+				D[dst.offset(i, j, k)] = src[finest.offset(i, j, k)];
+}
@@ -0,0 +1,68 @@
+// Geometric multigrid for the cell centered pressure Poisson problem.
+//
+// Every level stores the 7-point Laplacian implied by its fluid mask: a
+// fluid cell is coupled by -1 to each fluid neighbor and its diagonal counts
+// them, exactly like MACGrid::calculateAMatrix. Cells outside the mask
+// (solids, the domain boundary) act as Neumann walls. A coarse cell is fluid
+// if any of its 8 children is.
+//
+// Transfers are trilinear prolongation P and its transpose for restriction,
+// the smoother is red-black Gauss-Seidel run red->black before and
+// black->red after the coarse correction, so one V-cycle is a symmetric
+// operator and can precondition CG (MGPCG, McAdams et al. 2010).
+
+#ifndef MULTIGRID_H
+#define MULTIGRID_H
+
+#include "grid_data.h"
+#include <vector>
+
+class MultigridSolver
+{
+public:
+	MultigridSolver();
+
+	// Builds the level hierarchy for a dim[0]*dim[1]*dim[2] cell grid.
+	// fluid[i + dim[0]*(j + dim[1]*k)] marks the cells that take part in the solve.
+	void setup(const int dim[3], const std::vector<char>& fluid);
+	void clear() { mLevels.clear(); }
+	bool isSetup() const { return !mLevels.empty(); }
+	int numLevels() const { return (int) mLevels.size(); }
+
+	// z = M^-1 r using one V-cycle with a zero initial guess.
+	void applyVCycle(const GridData& r, GridData& z);
+
+	// Standalone solve of Ap = d by repeated V-cycles, starting from the current p.
+	// Stops once max|d - Ap| <= tolerance. Returns the number of cycles run,
+	// and the final max residual in residual.
+	int solve(GridData& p, const GridData& d, int maxCycles, double tolerance, double& residual);
+
+	int mPreSmoothing;      // Red-black sweeps before the coarse correction.
+	int mPostSmoothing;     // Black-red sweeps after it.
+	int mCoarsestSweeps;    // Symmetric sweep pairs on the coarsest level.
+
+private:
+	struct Level
+	{
+		int n[3];
+		int strideJ, strideK;
+		std::vector<Real> x, b, r;
+		std::vector<Real> diag, invDiag, mask;
+
+		// Padded by one cell on every side; the padding is never fluid.
+		int offset(int i, int j, int k) const { return (i+1) + (j+1)*strideJ + (k+1)*strideK; }
+	};
+
+	void smooth(Level& level, int color);
+	double computeResidual(Level& level);
+	void restrictResidual(const Level& fine, Level& coarse);
+	void prolongateCorrection(const Level& coarse, Level& fine);
+	void vcycle(int l);
+
+	void loadLevel0(const GridData& src, std::vector<Real>& dst) const;
+	void storeLevel0(const std::vector<Real>& src, GridData& dst) const;
+
+	std::vector<Level> mLevels;
+};
+
+#endif // MULTIGRID_H
@@ -8,7 +8,10 @@
 // #include "../../GL/GLU.h"
 // #include "../../GL/glut.h"
 
-#ifdef __linux__
+// Headless builds (SMOKE_HEADLESS) compile the simulation without any of the
+// rendering code and need no OpenGL at all.
+#ifdef SMOKE_HEADLESS
+#elif __linux__
     #include <GL/gl.h>
     #include <GL/glu.h>
     #include <GL/glut.h>
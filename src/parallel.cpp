@@ -0,0 +1,22 @@
+#include "parallel.h"
+
+namespace {
+	int theRequestedThreads = 0;
+}
+
+void Parallel::setNumThreads(int n) {
+	theRequestedThreads = n < 0 ? 0 : n;
+}
+
+int Parallel::numThreads() {
+	if (theRequestedThreads > 0) return theRequestedThreads;
+	return maxThreads();
+}
+
+int Parallel::maxThreads() {
+#ifdef _OPENMP
+	return omp_get_max_threads();
+#else
+	return 1;
+#endif
+}
@@ -0,0 +1,39 @@
+// Thread configuration shared by the parallel simulation passes.
+// Built on OpenMP; without it every PARALLEL_FOR loop simply runs serially.
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#ifdef _OPENMP
+#include <omp.h>
+#define PARALLEL_FOR _Pragma("omp parallel for schedule(dynamic, 1) num_threads(Parallel::numThreads())")
+// For sweeps made of many short dependent phases: open the thread team once
+// with PARALLEL_REGION and split each phase with PARALLEL_FOR_IN_REGION, which
+// ends in a barrier.
+#define PARALLEL_REGION _Pragma("omp parallel num_threads(Parallel::numThreads())")
+#define PARALLEL_FOR_IN_REGION _Pragma("omp for schedule(static)")
+// Vectorize the following innermost loop, optionally reducing into var.
+#define PARALLEL_PRAGMA(x) _Pragma(#x)
+#define SIMD_LOOP _Pragma("omp simd")
+#define SIMD_REDUCTION(op, var) PARALLEL_PRAGMA(omp simd reduction(op:var))
+#else
+#define PARALLEL_FOR
+#define PARALLEL_REGION
+#define PARALLEL_FOR_IN_REGION
+#define SIMD_LOOP
+#define SIMD_REDUCTION(op, var)
+#endif
+
+namespace Parallel {
+
+	// Number of worker threads used by PARALLEL_FOR loops.
+	// 0 (the default) means one thread per hardware core, 1 runs serially.
+	extern void setNumThreads(int n);
+	extern int numThreads();
+
+	// Hardware concurrency as reported by the runtime.
+	extern int maxThreads();
+
+}
+
+#endif // PARALLEL_H
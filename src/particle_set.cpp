@@ -0,0 +1,99 @@
+#include "particle_set.h"
+#include <algorithm>
+
+ParticleSet::ParticleSet() : mCapacity(0)
+{
+}
+
+int ParticleSet::numAlive() const
+{
+	return (int) (mAge.size() - std::count(mAge.begin(), mAge.end(), -1));
+}
+
+void ParticleSet::setCapacity(int n)
+{
+	mCapacity = n;
+	for (int axis = 0; axis < 3; axis++) {
+		mPosition[axis].reserve(n);
+		mVelocity[axis].reserve(n);
+	}
+	mAge.reserve(n);
+}
+
+void ParticleSet::clear()
+{
+	for (int axis = 0; axis < 3; axis++) {
+		mPosition[axis].clear();
+		mVelocity[axis].clear();
+	}
+	mAge.clear();
+}
+
+bool ParticleSet::add(const vec3& position)
+{
+	if (size() >= mCapacity) {
+		compact();
+		if (size() >= mCapacity) return false;
+	}
+	for (int axis = 0; axis < 3; axis++) {
+		mPosition[axis].push_back(position[axis]);
+		mVelocity[axis].push_back(0.0f);
+	}
+	mAge.push_back(0);
+	return true;
+}
+
+int ParticleSet::grow(int n, int& first)
+{
+	if (size() + n > mCapacity) compact();
+	n = std::max(std::min(n, mCapacity - size()), 0);
+	first = size();
+	for (int axis = 0; axis < 3; axis++) {
+		mPosition[axis].resize(first + n);
+		mVelocity[axis].resize(first + n, 0.0f);
+	}
+	mAge.resize(first + n, 0);
+	return n;
+}
+
+void ParticleSet::setPosition(int p, const vec3& x)
+{
+	for (int axis = 0; axis < 3; axis++) mPosition[axis][p] = x[axis];
+}
+
+void ParticleSet::setVelocity(int p, const vec3& v)
+{
+	for (int axis = 0; axis < 3; axis++) mVelocity[axis][p] = v[axis];
+}
+
+void ParticleSet::compact()
+{
+	int n = 0;
+	for (int p = 0; p < size(); p++) {
+		if (mAge[p] < 0) continue;
+		if (n != p) {
+			for (int axis = 0; axis < 3; axis++) {
+				mPosition[axis][n] = mPosition[axis][p];
+				mVelocity[axis][n] = mVelocity[axis][p];
+			}
+			mAge[n] = mAge[p];
+		}
+		n++;
+	}
+	// Shrinking keeps the reserved storage.
+	for (int axis = 0; axis < 3; axis++) {
+		mPosition[axis].resize(n);
+		mVelocity[axis].resize(n);
+	}
+	mAge.resize(n);
+}
+
+void ParticleSet::resize(int n)
+{
+	if (n > mCapacity) setCapacity(n);
+	for (int axis = 0; axis < 3; axis++) {
+		mPosition[axis].resize(n);
+		mVelocity[axis].resize(n);
+	}
+	mAge.resize(n);
+}
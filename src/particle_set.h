@@ -0,0 +1,79 @@
+// Rendering particles as a structure of arrays.
+//
+// Every coordinate of the positions and velocities lives in its own float
+// array, so passes over all particles stream through contiguous memory and
+// a chunk of particles fills whole SIMD registers. Floats hold world space
+// positions to well below a cell, and they are what the .bgeo caches store.
+//
+// The set is a pool of at most capacity() particles whose storage is
+// reserved up front, so emitting never reallocates. Every particle counts
+// its age in frames. retire() only marks a particle dead, which keeps the
+// indices of the others stable during a pass; compact() drops the dead
+// ones later, keeping the order of the live ones. Passes skip dead
+// particles and the caches leave them out.
+
+#ifndef PARTICLE_SET_H
+#define PARTICLE_SET_H
+
+#include "vec.h"
+#include <vector>
+
+class ParticleSet
+{
+public:
+	ParticleSet();
+
+	// Live and dead particles until the next compact().
+	int size() const { return (int) mAge.size(); }
+	bool empty() const { return mAge.empty(); }
+	int numAlive() const;
+
+	// Reserves storage for n particles, add() never goes beyond it.
+	void setCapacity(int n);
+	int capacity() const { return mCapacity; }
+
+	void clear();
+	// Appends a particle at rest with age 0. A full pool is compacted first;
+	// returns false, dropping the particle, if that frees no room.
+	bool add(const vec3& position);
+	// Appends up to n particles at rest with age 0 in one go and returns how
+	// many fit, the first of them at index first. A pool without room for n
+	// is compacted first, which drops the dead particles and moves the live
+	// ones to lower indices, so indices taken before the call are stale.
+	// The positions of the new particles are left to the caller, which may
+	// fill them from several threads.
+	int grow(int n, int& first);
+
+	vec3 position(int p) const { return vec3(mPosition[0][p], mPosition[1][p], mPosition[2][p]); }
+	vec3 velocity(int p) const { return vec3(mVelocity[0][p], mVelocity[1][p], mVelocity[2][p]); }
+	void setPosition(int p, const vec3& x);
+	void setVelocity(int p, const vec3& v);
+
+	bool isAlive(int p) const { return mAge[p] >= 0; }
+	int age(int p) const { return mAge[p]; }
+	void retire(int p) { mAge[p] = -1; }
+
+	// Coordinate axis of every particle, size() entries each.
+	float* positions(int axis) { return mPosition[axis].data(); }
+	const float* positions(int axis) const { return mPosition[axis].data(); }
+	float* velocities(int axis) { return mVelocity[axis].data(); }
+	const float* velocities(int axis) const { return mVelocity[axis].data(); }
+	// Age in frames of every particle, < 0 for dead ones.
+	int* ages() { return mAge.data(); }
+	const int* ages() const { return mAge.data(); }
+
+	// Removes the dead particles.
+	void compact();
+
+	// Sets size() particles, positions, velocities and ages unspecified, e.g.
+	// to read them back from a checkpoint. Grows the capacity if needed.
+	void resize(int n);
+
+private:
+	int mCapacity;
+	std::vector<float> mPosition[3];
+	std::vector<float> mVelocity[3];
+	std::vector<int> mAge;
+};
+
+#endif // PARTICLE_SET_H
@@ -0,0 +1,166 @@
+#include "profiler.h"
+#include "custom_output.h"
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+
+Profiler::Profiler() : mEnabled(false)
+{
+}
+
+void Profiler::clear()
+{
+	mStages.clear();
+	mFrames.clear();
+}
+
+void Profiler::beginFrame(int frame)
+{
+	if (!mEnabled) return;
+	Frame f;
+	f.number = frame;
+	f.iterations = 0;
+	f.residual = 0.0;
+	mFrames.push_back(f);
+}
+
+void Profiler::add(const char* stage, double seconds)
+{
+	if (!mEnabled) return;
+	if (mFrames.empty()) beginFrame(0);
+	const int s = stageIndex(stage);
+	std::vector<double>& times = mFrames.back().seconds;
+	if ((int) times.size() <= s) times.resize(s + 1, -1.0);
+	times[s] = std::max(times[s], 0.0) + seconds;
+}
+
+void Profiler::setSolverStats(int iterations, double residual)
+{
+	if (!mEnabled || mFrames.empty()) return;
+	mFrames.back().iterations = iterations;
+	mFrames.back().residual = residual;
+}
+
+int Profiler::stageIndex(const char* stage)
+{
+	for (size_t s = 0; s < mStages.size(); s++) {
+		if (mStages[s] == stage) return (int) s;
+	}
+	mStages.push_back(stage);
+	return (int) mStages.size() - 1;
+}
+
+double Profiler::seconds(const Frame& frame, int stage) const
+{
+	return stage < (int) frame.seconds.size() ? frame.seconds[stage] : -1.0;
+}
+
+Profiler::Summary Profiler::summarize(int stage) const
+{
+	std::vector<double> values;
+	for (size_t f = 0; f < mFrames.size(); f++) {
+		double t = seconds(mFrames[f], stage);
+		if (t >= 0.0) values.push_back(t);
+	}
+
+	Summary summary = { (int) values.size(), 0.0, 0.0, 0.0, 0.0 };
+	if (values.empty()) return summary;
+	std::sort(values.begin(), values.end());
+	double sum = 0.0;
+	for (size_t v = 0; v < values.size(); v++) sum += values[v];
+	// Nearest-rank percentiles.
+	const int n = (int) values.size();
+	summary.mean = sum / n;
+	summary.p50 = values[std::max((int) ceil(0.50 * n) - 1, 0)];
+	summary.p99 = values[std::max((int) ceil(0.99 * n) - 1, 0)];
+	summary.max = values.back();
+	return summary;
+}
+
+bool Profiler::write(const std::string& filename) const
+{
+	const char* json = ".json";
+	if (filename.size() >= 5 && filename.compare(filename.size() - 5, 5, json) == 0) return writeJson(filename);
+	return writeCsv(filename);
+}
+
+bool Profiler::writeCsv(const std::string& filename) const
+{
+	FILE* file = fopen(filename.c_str(), "w");
+	if (!file) return false;
+
+	fprintf(file, "frame");
+	for (size_t s = 0; s < mStages.size(); s++) fprintf(file, ",%s", mStages[s].c_str());
+	fprintf(file, ",solver_iterations,solver_residual\n");
+
+	for (size_t f = 0; f < mFrames.size(); f++) {
+		const Frame& frame = mFrames[f];
+		fprintf(file, "%d", frame.number);
+		for (size_t s = 0; s < mStages.size(); s++) {
+			double t = seconds(frame, s);
+			if (t >= 0.0) fprintf(file, ",%.9f", t);
+			else fprintf(file, ",");
+		}
+		fprintf(file, ",%d,%.9g\n", frame.iterations, frame.residual);
+	}
+	return fclose(file) == 0;
+}
+
+bool Profiler::writeJson(const std::string& filename) const
+{
+	FILE* file = fopen(filename.c_str(), "w");
+	if (!file) return false;
+
+	fprintf(file, "{\n  \"stages\": [");
+	for (size_t s = 0; s < mStages.size(); s++) fprintf(file, "%s\"%s\"", s ? ", " : "", mStages[s].c_str());
+	fprintf(file, "],\n  \"frames\": [");
+
+	for (size_t f = 0; f < mFrames.size(); f++) {
+		const Frame& frame = mFrames[f];
+		fprintf(file, "%s\n    { \"frame\": %d, \"solver_iterations\": %d, \"solver_residual\": %.9g, \"seconds\": {",
+		        f ? "," : "", frame.number, frame.iterations, frame.residual);
+		bool first = true;
+		for (size_t s = 0; s < mStages.size(); s++) {
+			double t = seconds(frame, s);
+			if (t < 0.0) continue;
+			fprintf(file, "%s\"%s\": %.9f", first ? " " : ", ", mStages[s].c_str(), t);
+			first = false;
+		}
+		fprintf(file, " } }");
+	}
+
+	fprintf(file, "\n  ],\n  \"summary\": {");
+	for (size_t s = 0; s < mStages.size(); s++) {
+		Summary summary = summarize(s);
+		fprintf(file, "%s\n    \"%s\": { \"count\": %d, \"mean\": %.9f, \"p50\": %.9f, \"p99\": %.9f, \"max\": %.9f }",
+		        s ? "," : "", mStages[s].c_str(), summary.count, summary.mean, summary.p50, summary.p99, summary.max);
+	}
+	fprintf(file, "\n  }\n}\n");
+	return fclose(file) == 0;
+}
+
+void Profiler::printSummary() const
+{
+	char line[256];
+	snprintf(line, sizeof(line), "%-20s %7s %10s %10s %10s %10s", "stage (ms)", "frames", "mean", "p50", "p99", "max");
+	PRINT_LINE(line);
+	for (size_t s = 0; s < mStages.size(); s++) {
+		Summary summary = summarize(s);
+		snprintf(line, sizeof(line), "%-20s %7d %10.3f %10.3f %10.3f %10.3f", mStages[s].c_str(), summary.count,
+		         1000.0 * summary.mean, 1000.0 * summary.p50, 1000.0 * summary.p99, 1000.0 * summary.max);
+		PRINT_LINE(line);
+	}
+}
+
+Profiler::Scope::Scope(Profiler& profiler, const char* stage) : mProfiler(profiler), mStage(stage)
+{
+	if (!mProfiler.isEnabled()) return;
+	mProfiler.stageIndex(stage); // Outer scopes list before the stages they contain.
+	mStart = std::chrono::steady_clock::now();
+}
+
+Profiler::Scope::~Scope()
+{
+	if (mProfiler.isEnabled())
+		mProfiler.add(mStage, std::chrono::duration<double>(std::chrono::steady_clock::now() - mStart).count());
+}
@@ -0,0 +1,74 @@
+// Per-stage timing of the simulation.
+//
+// Profiler::Scope adds the wall time of its lifetime to a named stage of the
+// current frame. beginFrame() opens the next frame; stages timed before the
+// next call (cache writes, screen grabs) count towards it. Every frame also
+// keeps the pressure solver's iteration count and final residual.
+//
+// write() saves one CSV row or JSON object per frame, printSummary() reports
+// mean, p50, p99 and max of every stage over the frames it ran in. A disabled
+// profiler records nothing and its scopes do not read the clock.
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+class Profiler
+{
+public:
+	Profiler();
+
+	void setEnabled(bool on) { mEnabled = on; }
+	bool isEnabled() const { return mEnabled; }
+	void clear();
+
+	void beginFrame(int frame);
+	void add(const char* stage, double seconds);
+	void setSolverStats(int iterations, double residual);
+
+	// JSON if filename ends in .json, CSV otherwise. Times are in seconds.
+	bool write(const std::string& filename) const;
+	bool writeCsv(const std::string& filename) const;
+	bool writeJson(const std::string& filename) const;
+	void printSummary() const;
+
+	class Scope
+	{
+	public:
+		Scope(Profiler& profiler, const char* stage);
+		~Scope();
+
+	private:
+		Profiler& mProfiler;
+		const char* mStage;
+		std::chrono::steady_clock::time_point mStart;
+	};
+
+private:
+	struct Frame
+	{
+		int number;
+		std::vector<double> seconds; // Per stage, < 0 if it did not run.
+		int iterations;
+		double residual;
+	};
+
+	struct Summary
+	{
+		int count;
+		double mean, p50, p99, max;
+	};
+
+	int stageIndex(const char* stage);
+	Summary summarize(int stage) const;
+	double seconds(const Frame& frame, int stage) const;
+
+	bool mEnabled;
+	std::vector<std::string> mStages; // In order of first use.
+	std::vector<Frame> mFrames;
+};
+
+#endif // PROFILER_H
@@ -0,0 +1,63 @@
+// Small, fast random number generator whose whole state is two integers, so
+// it can be stored in a checkpoint and a restarted run draws the same numbers.
+// PCG32 (XSH RR variant) after M. O'Neill, "PCG: A Family of Simple Fast
+// Space-Efficient Statistically Good Algorithms for Random Number Generation".
+//
+// Parallel loops give every item its own generator, seeded with hash() of
+// counters that identify the item (frame, source, cell, ...). The numbers an
+// item draws then depend on nothing else, neither the thread that runs it
+// nor the items run before, and a restart only needs the counters.
+
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <stdint.h>
+
+class Random
+{
+public:
+	explicit Random(uint64_t seed = 42u, uint64_t stream = 54u) { setSeed(seed, stream); }
+
+	void setSeed(uint64_t seed, uint64_t stream = 54u)
+	{
+		state = 0u;
+		increment = (stream << 1u) | 1u;
+		next();
+		state += seed;
+		next();
+	}
+
+	uint32_t next()
+	{
+		uint64_t old = state;
+		state = old * 6364136223846793005ULL + increment;
+		uint32_t xorshifted = (uint32_t) (((old >> 18u) ^ old) >> 27u);
+		uint32_t rot = (uint32_t) (old >> 59u);
+		return (xorshifted >> rot) | (xorshifted << ((32u - rot) & 31u));
+	}
+
+	// Uniform in [0, 1).
+	double uniform() { return next() * (1.0 / 4294967296.0); }
+
+	// Seed for the item identified by a, b and c. Each counter goes through
+	// the SplitMix64 finalizer, so neighbouring keys give unrelated seeds.
+	static uint64_t hash(uint64_t a, uint64_t b = 0u, uint64_t c = 0u)
+	{
+		uint64_t h = mix(a + 0x9E3779B97F4A7C15ULL);
+		h = mix(h ^ (b + 0x9E3779B97F4A7C15ULL));
+		return mix(h ^ (c + 0x9E3779B97F4A7C15ULL));
+	}
+
+	uint64_t state;
+	uint64_t increment;
+
+private:
+	static uint64_t mix(uint64_t z)
+	{
+		z = (z ^ (z >> 30u)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27u)) * 0x94D049BB133111EBULL;
+		return z ^ (z >> 31u);
+	}
+};
+
+#endif // RANDOM_H
@@ -0,0 +1,28 @@
+// Floating point type of the simulation fields.
+//
+// Real is what GridData stores, and with it the pressure matrix, the
+// preconditioner and the solver vectors. Builds with SMOKE_FLOAT (CMake
+// option SMOKE_USE_FLOAT) store single precision, which halves memory and
+// bandwidth and fits twice the lanes in every SIMD register. Configuration,
+// positions (vec3) and the per-call arithmetic in between stay double.
+//
+// SolverReal is what the pressure solve accumulates dot products and norms
+// in. It stays double in float builds unless SMOKE_FLOAT_ACCUMULATION is
+// defined too, trading a few extra iterations for pure float arithmetic.
+
+#ifndef REAL_H
+#define REAL_H
+
+#ifdef SMOKE_FLOAT
+typedef float Real;
+#else
+typedef double Real;
+#endif
+
+#if defined(SMOKE_FLOAT) && defined(SMOKE_FLOAT_ACCUMULATION)
+typedef float SolverReal;
+#else
+typedef double SolverReal;
+#endif
+
+#endif // REAL_H
@@ -7,13 +7,23 @@
 #include "basic_math.h"
 #include <fstream>
 
-SmokeSim::SmokeSim() : mFrameNum(0), mTotalFrameNum(0), mRecordEnabled(false) // Set true for reocording from begining (Linghan)
+SmokeSim::SmokeSim() : mFrameNum(0), mTotalFrameNum(0), mRecordEnabled(false), // Set true for reocording from begining (Linghan)
+   mCheckpointInterval(0)
+{
+   reset();
+}
+
+SmokeSim::SmokeSim(const SimConfig& config) : mGrid(config), mFrameNum(0), mTotalFrameNum(0), mRecordEnabled(false),
+   mCheckpointInterval(0)
 {
    reset();
 }
 
 SmokeSim::~SmokeSim()
 {
+	if (!mProfiler.isEnabled()) return;
+	if (!mProfiler.write(mProfileFile)) PRINT_LINE("Could not write profile " << mProfileFile);
+	mProfiler.printSummary();
 }
 
 void SmokeSim::reset()
@@ -22,43 +32,141 @@ void SmokeSim::reset()
 	mTotalFrameNum = 0;
 }
 
-/*
 void SmokeSim::setGridDimensions(int x, int y, int z)
 {
-   //extern int theDim[3]; // Naughty globals...
-   theDim[0] = x;
-   theDim[1] = y;
-   theDim[2] = z;
+   SimConfig config = mGrid.getConfig();
+   config.setDimensions(x, y, z);
+   setConfig(config);
+}
+
+void SmokeSim::setConfig(const SimConfig& config)
+{
+   mGrid.initialize(config);
    reset();
 }
-*/
 
 void SmokeSim::step()
 {
 	double dt = 0.1;//0.04 or 0.1;
 
+	mProfiler.beginFrame(mTotalFrameNum);
+	Profiler::Scope stepScope(mProfiler, "step");
+
     //mGrid.updateBox();
 
     // Step0: Gather user forces
-	if(mTotalFrameNum < 100)
+	{
+		Profiler::Scope scope(mProfiler, "sources");
     	mGrid.updateSources();
+	}
 
     // Step1: Calculate new velocities
-    mGrid.advectVelocity(dt); // get Velocity_hat
-    mGrid.addExternalForces(dt); // get Velocity_star
-    mGrid.project(dt); // get Velocity_n+1
-
-    // Step2: Calculate new temperature
-    mGrid.advectTemperature(dt);
+	{
+		Profiler::Scope scope(mProfiler, "advect_velocity");
+		mGrid.advectVelocity(dt); // get Velocity_hat
+	}
+	{
+		Profiler::Scope scope(mProfiler, "forces"); // Buoyancy and vorticity confinement.
+		mGrid.addExternalForces(dt); // get Velocity_star
+	}
+	{
+		Profiler::Scope scope(mProfiler, "project");
+		mGrid.project(dt); // get Velocity_n+1
+	}
+	mProfiler.setSolverStats(mGrid.getSolverIterations(), mGrid.getSolverResidual());
 
-    // Step3: Calculate new density
-    mGrid.advectDensity(dt);
+    // Step2 and 3: Calculate new temperature and density
+	{
+		Profiler::Scope scope(mProfiler, "advect_scalars");
+		mGrid.advectDensityAndTemperature(dt);
+	}
 
     // Step4: Advect rendering particles
-	mGrid.advectRenderingParticles(dt);
+	{
+		Profiler::Scope scope(mProfiler, "advect_particles");
+		mGrid.advectRenderingParticles(dt);
+		const int interval = mGrid.getConfig().particleCompactInterval;
+		if (interval > 0 && (mTotalFrameNum + 1) % interval == 0) mGrid.rendering_particles.compact();
+	}
 
 
 	mTotalFrameNum++;
+
+	if (mCheckpointInterval > 0 && mTotalFrameNum % mCheckpointInterval == 0)
+	{
+		Profiler::Scope scope(mProfiler, "checkpoint");
+		// The caches of the frames before this one may still be queued; once
+		// the checkpoint exists a restart no longer rewrites them.
+		mCacheWriter.flush();
+		if (!saveCheckpoint(mCheckpointFile)) PRINT_LINE("Could not write checkpoint " << mCheckpointFile);
+	}
+}
+
+namespace
+{
+	const char CHECKPOINT_MAGIC[8] = { 'S', 'M', 'O', 'K', 'E', 'C', 'K', 'P' };
+	const unsigned int CHECKPOINT_VERSION = 6;
+}
+
+bool SmokeSim::saveCheckpoint(const std::string& filename)
+{
+	mCheckpoint.clear();
+	mCheckpoint.write(CHECKPOINT_MAGIC);
+	mCheckpoint.write(CHECKPOINT_VERSION);
+	mCheckpoint.write(mTotalFrameNum);
+	mCheckpoint.write(mFrameNum);
+	mGrid.saveState(mCheckpoint);
+	return mCheckpoint.save(filename);
+}
+
+bool SmokeSim::loadCheckpoint(const std::string& filename)
+{
+	CheckpointReader in;
+	if (!in.load(filename)) return false;
+
+	char magic[8];
+	unsigned int version = 0;
+	int totalFrameNum = 0, frameNum = 0;
+	in.read(magic);
+	in.read(version);
+	in.read(totalFrameNum);
+	in.read(frameNum);
+	if (in.failed() || memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0 || version != CHECKPOINT_VERSION) return false;
+
+	if (!mGrid.loadState(in))
+	{
+		reset();
+		return false;
+	}
+	mTotalFrameNum = totalFrameNum;
+	mFrameNum = frameNum;
+	return true;
+}
+
+void SmokeSim::setCheckpointInterval(int frames, const std::string& filename)
+{
+	mCheckpointInterval = frames;
+	mCheckpointFile = filename;
+}
+
+void SmokeSim::setProfileOutput(const std::string& filename)
+{
+	mProfileFile = filename;
+	mProfiler.clear();
+	mProfiler.setEnabled(!filename.empty());
+}
+
+bool SmokeSim::loadScene(const std::string& filename)
+{
+	std::vector<Emitter> emitters;
+	std::string error;
+	if (!Emitter::load(filename, emitters, error)) {
+		PRINT_LINE("Could not load scene: " << error);
+		return false;
+	}
+	mGrid.setEmitters(emitters);
+	PRINT_LINE("Loaded " << emitters.size() << " emitter(s) from " << filename);
+	return true;
 }
 
 void SmokeSim::setRecording(bool on, int width, int height)
@@ -79,6 +187,22 @@ bool SmokeSim::isRecording()
    return mRecordEnabled;
 }
 
+void SmokeSim::writeCache(const std::string& directory, int frame)
+{
+	// Snapshot the density field and rendering particles, the .bgeo files
+	// are written on the cache writer's thread.
+	Profiler::Scope scope(mProfiler, "cache_write");
+	mCacheWriter.write(mGrid, directory, frame);
+}
+
+void SmokeSim::flushCache()
+{
+	Profiler::Scope scope(mProfiler, "cache_write");
+	mCacheWriter.flush();
+}
+
+#ifndef SMOKE_HEADLESS
+
 void SmokeSim::draw(const Camera& c)
 {
    drawAxes(); 
@@ -110,13 +234,12 @@ void SmokeSim::drawAxes()
 
 void SmokeSim::grabScreen()  // Code adapted from asst#1 . USING STB_IMAGE_WRITE INSTEAD OF DEVIL.
 {
-	if (mFrameNum > 300) exit(0);
+	if (mFrameNum > 300) { flushCache(); exit(0); }
 
-	// Save density field to a .bgeo file
-	std::string densityFile = "../records/DensityFrame" + std::to_string(mFrameNum) + ".bgeo";
-	mGrid.saveDensity(densityFile);
+	writeCache("../records", mFrameNum);
 
 	// Save an image:
+	Profiler::Scope scope(mProfiler, "screen_grab");
 	unsigned char* bitmapData = new unsigned char[3 * recordWidth * recordHeight];
 	for (int i=0; i<recordHeight; i++) 
 	{
@@ -128,13 +251,11 @@ void SmokeSim::grabScreen()  // Code adapted from asst#1 . USING STB_IMAGE_WRITE
 	//stbi_write_png(anim_filename, recordWidth, recordHeight, 3, bitmapData, recordWidth * 3);
 	//delete [] bitmapData;
 
-	// Dump out rendering particle data in .bgeo file
-	std::string particleFile = "../records/frame" + std::to_string(mFrameNum) + ".bgeo";
-	mGrid.saveParticle(particleFile);
-
 	mFrameNum++;
 }
 
+#endif // SMOKE_HEADLESS
+
 int SmokeSim::getTotalFrames() {
 	return mTotalFrameNum;
 }
\ No newline at end of file
@@ -3,31 +3,73 @@
 #define smokeSim_H_
 
 #include "mac_grid.h"
+#include "cache_writer.h"
+#include "checkpoint.h"
+#include "profiler.h"
 #include <Partio.h>
+#include <string>
 
 class Camera;
 class SmokeSim
 {
 public:
    SmokeSim();
+   explicit SmokeSim(const SimConfig& config);
    virtual ~SmokeSim();
 
    virtual void reset();
    virtual void step();
+#ifndef SMOKE_HEADLESS
    virtual void draw(const Camera& c);
-   //virtual void setGridDimensions(int x, int y, int z); 
+#endif
+   virtual void setGridDimensions(int x, int y, int z); 
+   virtual void setConfig(const SimConfig& config);
+   const SimConfig& getConfig() const { return mGrid.getConfig(); }
    virtual void setRecording(bool on, int width, int height);
    virtual bool isRecording();
+
+   // Writes the density field and rendering particles of the current state to
+   // directory/DensityFrame<frame>.bgeo and directory/frame<frame>.bgeo.
+   // The files are written in the background, flushCache() waits for them.
+   virtual void writeCache(const std::string& directory, int frame);
+   void flushCache();
+   void setCacheFormats(int formats) { mCacheWriter.setFormats(formats); } // CacheWriter::Format flags
 	
 	
 	int getTotalFrames();
 
+   // Checkpoint/restart of the whole simulation state, including the frame
+   // counters. A run restarted from a checkpoint steps exactly like the
+   // original one. Both return false on I/O or format errors; a failed load
+   // leaves the simulation reset.
+   bool saveCheckpoint(const std::string& filename);
+   bool loadCheckpoint(const std::string& filename);
+
+   // Saves a checkpoint to filename after every frames steps, 0 turns it off.
+   // Waits for the queued caches first, so only the cache of the frame just
+   // stepped can be missing after a crash.
+   void setCheckpointInterval(int frames, const std::string& filename);
+
+   // Times every stage of step(), cache writes and screen grabs per frame and
+   // writes them to filename (.csv or .json) when the simulation is destroyed,
+   // printing a summary of every stage. An empty filename turns it off.
+   void setProfileOutput(const std::string& filename);
+   const Profiler& getProfiler() const { return mProfiler; }
+
+   // Replaces the sources with the emitters of a scene file, see emitter.h.
+   // Returns false, printing why and keeping the current sources, if the
+   // file cannot be read.
+   bool loadScene(const std::string& filename);
+
 protected:
+#ifndef SMOKE_HEADLESS
    virtual void drawAxes();
    virtual void grabScreen();
+#endif
 
 protected:
 	MACGrid mGrid;
+	CacheWriter mCacheWriter;
 	bool mRecordEnabled;
 	int mFrameNum;
 	int mTotalFrameNum; 
@@ -35,6 +77,13 @@ protected:
 	
 	int recordWidth;
 	int recordHeight;
+
+	CheckpointWriter mCheckpoint; // Keeps its buffer between checkpoints.
+	int mCheckpointInterval;
+	std::string mCheckpointFile;
+
+	Profiler mProfiler;
+	std::string mProfileFile;
 };
 
 #endif
\ No newline at end of file
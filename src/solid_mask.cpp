@@ -0,0 +1,122 @@
+#include "solid_mask.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+
+SolidMask::SolidMask() {
+	for (int axis = 0; axis < 3; axis++) {
+		mDim[axis] = mCellDim[axis] = mFaceDim[axis] = 0;
+		mSolidLo[axis] = mSolidHi[axis] = 0;
+	}
+	mCellSize = 1.0;
+}
+
+void SolidMask::initialize(const SimConfig& config) {
+	for (int axis = 0; axis < 3; axis++) {
+		mDim[axis] = config.dim[axis];
+		mCellDim[axis] = config.dim[axis] + 2;
+		mFaceDim[axis] = config.dim[axis] + 3;
+	}
+	mCellSize = config.cellSize;
+	mCells.assign(mCellDim[0] * mCellDim[1] * mCellDim[2], 0);
+	for (int axis = 0; axis < 3; axis++) mFaces[axis].assign(mFaceDim[0] * mFaceDim[1] * mFaceDim[2], FACE_OUTSIDE);
+	update();
+}
+
+void SolidMask::clear() {
+	std::fill(mCells.begin(), mCells.end(), 0);
+}
+
+void SolidMask::setSolid(int i, int j, int k, bool solid) {
+	if (i < 0 || j < 0 || k < 0 || i >= mDim[0] || j >= mDim[1] || k >= mDim[2]) return;
+	mCells[cell(i, j, k)] = solid ? 1 : 0;
+}
+
+void SolidMask::addBox(const int lo[3], const int hi[3]) {
+	for (int j = std::max(lo[1], 0); j < std::min(hi[1], mDim[1]); j++)
+		for (int k = std::max(lo[2], 0); k < std::min(hi[2], mDim[2]); k++)
+			for (int i = std::max(lo[0], 0); i < std::min(hi[0], mDim[0]); i++)
+				mCells[cell(i, j, k)] = 1;
+}
+
+void SolidMask::addSphere(const vec3& center, double radius) {
+	// Cell i is centered at (i + 0.5) * cellSize.
+	int lo[3], hi[3];
+	for (int axis = 0; axis < 3; axis++) {
+		lo[axis] = std::max((int) floor((center[axis] - radius) / mCellSize - 0.5), 0);
+		hi[axis] = std::min((int) ceil((center[axis] + radius) / mCellSize - 0.5) + 1, mDim[axis]);
+	}
+	for (int j = lo[1]; j < hi[1]; j++)
+		for (int k = lo[2]; k < hi[2]; k++)
+			for (int i = lo[0]; i < hi[0]; i++) {
+				vec3 pt((i + 0.5) * mCellSize, (j + 0.5) * mCellSize, (k + 0.5) * mCellSize);
+				if ((pt - center).SqrLength() <= radius * radius) mCells[cell(i, j, k)] = 1;
+			}
+}
+
+void SolidMask::update() {
+	const int cellStep[3] = { 1, mCellDim[0] * mCellDim[2], mCellDim[0] };
+
+	// Every face (i,j,k) of an axis lies between the cells (i,j,k) - axis
+	// and (i,j,k); the ghost cells beyond the border are fluid.
+	PARALLEL_FOR
+	for (int j = 0; j <= mDim[1]; j++) {
+		for (int k = 0; k <= mDim[2]; k++) {
+			for (int i = 0; i <= mDim[0]; i++) {
+				const int index[3] = { i, j, k };
+				const int c = cell(i, j, k), f = face(i, j, k);
+				for (int axis = 0; axis < 3; axis++) {
+					const int a1 = (axis + 1) % 3, a2 = (axis + 2) % 3;
+					if (index[a1] == mDim[a1] || index[a2] == mDim[a2]) {
+						mFaces[axis][f] = FACE_OUTSIDE;
+						continue;
+					}
+					const bool lower = mCells[c - cellStep[axis]] != 0, upper = mCells[c] != 0;
+					if (lower && upper) mFaces[axis][f] = FACE_SOLID;
+					else if (lower || upper || index[axis] == 0 || index[axis] == mDim[axis]) mFaces[axis][f] = FACE_WALL;
+					else mFaces[axis][f] = FACE_FLUID;
+				}
+			}
+		}
+	}
+
+	for (int axis = 0; axis < 3; axis++) {
+		mSolidLo[axis] = mDim[axis];
+		mSolidHi[axis] = 0;
+	}
+	for (int j = 0; j < mDim[1]; j++)
+		for (int k = 0; k < mDim[2]; k++)
+			for (int i = 0; i < mDim[0]; i++) {
+				if (!mCells[cell(i, j, k)]) continue;
+				const int index[3] = { i, j, k };
+				for (int axis = 0; axis < 3; axis++) {
+					mSolidLo[axis] = std::min(mSolidLo[axis], index[axis]);
+					mSolidHi[axis] = std::max(mSolidHi[axis], index[axis] + 1);
+				}
+			}
+}
+
+int SolidMask::numSolid() const {
+	return (int) std::count(mCells.begin(), mCells.end(), 1);
+}
+
+bool SolidMask::solidExtent(const vec3& pt, double lo[3], double hi[3]) const {
+	int index[3];
+	for (int axis = 0; axis < 3; axis++) {
+		index[axis] = (int) floor(pt[axis] / mCellSize);
+		if (index[axis] < 0 || index[axis] >= mDim[axis]) return false;
+	}
+	const int c = cell(index[0], index[1], index[2]);
+	if (!mCells[c]) return false;
+
+	const int cellStep[3] = { 1, mCellDim[0] * mCellDim[2], mCellDim[0] };
+	for (int axis = 0; axis < 3; axis++) {
+		// The ghost cells end every run at the border.
+		int first = 0, last = 0;
+		while (mCells[c + (first - 1) * cellStep[axis]]) first--;
+		while (mCells[c + (last + 1) * cellStep[axis]]) last++;
+		lo[axis] = (index[axis] + first) * mCellSize;
+		hi[axis] = (index[axis] + last + 1) * mCellSize;
+	}
+	return true;
+}
@@ -0,0 +1,79 @@
+// Solid obstacles on a MAC grid.
+//
+// Every cell is either solid or fluid, so obstacles of any voxelized shape,
+// and any number of them, live in one byte grid. update() classifies every
+// face from its two cells once, after the solids change:
+//
+//   FACE_OUTSIDE  no face of that axis at these indices
+//   FACE_SOLID    between two solid cells, not simulated
+//   FACE_WALL     on the domain border or between a solid and a fluid cell,
+//                 its velocity is held at 0
+//   FACE_FLUID    between two fluid cells
+//
+// The solver passes then test a cell or a face with a single load instead
+// of comparing its indices against every obstacle. Both grids carry a layer
+// of ghost entries on each side, cells at -1 and dim and faces at -1 and
+// dim + 1 are valid arguments: ghost cells are fluid, ghost faces outside.
+
+#ifndef SOLID_MASK_H
+#define SOLID_MASK_H
+
+#include "constants.h"
+#include "vec.h"
+#include <vector>
+
+class SolidMask {
+public:
+	enum FaceType { FACE_OUTSIDE, FACE_SOLID, FACE_WALL, FACE_FLUID };
+
+	SolidMask();
+
+	// Sizes the mask for the cells of config, all fluid.
+	void initialize(const SimConfig& config);
+	int dim(int axis) const { return mDim[axis]; }
+
+	// Edits the cells, call update() afterwards. Cells outside are ignored.
+	void clear();
+	void setSolid(int i, int j, int k, bool solid = true);
+	// The cells [lo, hi).
+	void addBox(const int lo[3], const int hi[3]);
+	// The cells whose centers lie inside the sphere, in world space.
+	void addSphere(const vec3& center, double radius);
+
+	// Classifies the faces and finds the bounds of the solid cells.
+	void update();
+
+	int numSolid() const;
+	bool isSolid(int i, int j, int k) const { return mCells[cell(i, j, k)] != 0; }
+
+	FaceType faceType(int axis, int i, int j, int k) const { return (FaceType) mFaces[axis][face(i, j, k)]; }
+	bool isValidFace(int axis, int i, int j, int k) const { return mFaces[axis][face(i, j, k)] >= FACE_WALL; }
+	bool isWallFace(int axis, int i, int j, int k) const { return mFaces[axis][face(i, j, k)] == FACE_WALL; }
+	bool isSolidFace(int axis, int i, int j, int k) const { return mFaces[axis][face(i, j, k)] == FACE_SOLID; }
+
+	// The solid cells lie in [lo, hi), lo > hi when there are none.
+	const int* solidLo() const { return mSolidLo; }
+	const int* solidHi() const { return mSolidHi; }
+
+	// If the point lies in a solid cell, returns true with the world space
+	// extent, along every axis, of the run of solid cells through that cell.
+	bool solidExtent(const vec3& pt, double lo[3], double hi[3]) const;
+
+	// The cells as stored, ghost cells included, e.g. for checkpoints.
+	std::vector<unsigned char>& cells() { return mCells; }
+	const std::vector<unsigned char>& cells() const { return mCells; }
+
+private:
+	int cell(int i, int j, int k) const { return (i + 1) + mCellDim[0] * ((k + 1) + mCellDim[2] * (j + 1)); }
+	int face(int i, int j, int k) const { return (i + 1) + mFaceDim[0] * ((k + 1) + mFaceDim[2] * (j + 1)); }
+
+	int mDim[3];
+	int mCellDim[3]; // dim + 2 with the ghost cells.
+	int mFaceDim[3]; // dim + 3 with the ghost faces.
+	double mCellSize;
+	int mSolidLo[3], mSolidHi[3];
+	std::vector<unsigned char> mCells;    // Indexed like the cells, j slowest.
+	std::vector<unsigned char> mFaces[3]; // FaceType of every face per axis.
+};
+
+#endif // SOLID_MASK_H
@@ -0,0 +1,89 @@
+#include "tile_mask.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+
+TileMask::TileMask() {
+	mTiles[0] = mTiles[1] = mTiles[2] = 0;
+	mDim[0] = mDim[1] = mDim[2] = 0;
+}
+
+void TileMask::initialize(const SimConfig& config) {
+	for (int axis = 0; axis < 3; axis++) {
+		mDim[axis] = config.dim[axis];
+		mTiles[axis] = (config.dim[axis] + TILE - 1) / TILE;
+	}
+	mActive.assign(mTiles[0] * mTiles[1] * mTiles[2], 1);
+}
+
+int TileMask::numActive() const {
+	return (int) std::count(mActive.begin(), mActive.end(), 1);
+}
+
+void TileMask::setAll(bool active) {
+	std::fill(mActive.begin(), mActive.end(), active ? 1 : 0);
+}
+
+void TileMask::activateCell(int i, int j, int k) {
+	if (i < 0 || j < 0 || k < 0 || i >= mDim[0] || j >= mDim[1] || k >= mDim[2]) return;
+	mActive[i / TILE + mTiles[0] * (k / TILE + mTiles[2] * (j / TILE))] = 1;
+}
+
+void TileMask::update(GridData* const fields[], int count, double cutoff) {
+	const int numTiles = (int) mActive.size();
+
+	PARALLEL_FOR
+	for (int t = 0; t < numTiles; t++) {
+		const int ti = t % mTiles[0], tk = (t / mTiles[0]) % mTiles[2], tj = t / (mTiles[0] * mTiles[2]);
+		const int i0 = ti * TILE, i1 = std::min(i0 + TILE, mDim[0]);
+		const int j0 = tj * TILE, j1 = std::min(j0 + TILE, mDim[1]);
+		const int k0 = tk * TILE, k1 = std::min(k0 + TILE, mDim[2]);
+
+		double largest = 0.0;
+		for (int c = 0; c < count && largest <= cutoff; c++) {
+			const Real* X = fields[c]->raw();
+			for (int j = j0; j < j1; j++) {
+				for (int k = k0; k < k1; k++) {
+					const Real* row = X + fields[c]->offset(0, j, k);
+					for (int i = i0; i < i1; i++) largest = std::max(largest, (double) std::abs(row[i]));
+				}
+			}
+		}
+		mActive[t] = largest > cutoff ? 1 : 0;
+
+		if (mActive[t] || largest == 0.0) continue;
+		for (int c = 0; c < count; c++) {
+			Real* X = fields[c]->raw();
+			for (int j = j0; j < j1; j++) {
+				for (int k = k0; k < k1; k++) {
+					Real* row = X + fields[c]->offset(0, j, k);
+					std::fill(row + i0, row + i1, (Real) 0);
+				}
+			}
+		}
+	}
+}
+
+void TileMask::dilate(const TileMask& source, int radius) {
+	for (int axis = 0; axis < 3; axis++) {
+		mDim[axis] = source.mDim[axis];
+		mTiles[axis] = source.mTiles[axis];
+	}
+	mActive = source.mActive;
+	if (radius <= 0) return;
+
+	// One pass per axis, each spreading the tiles radius steps along it.
+	const int step[3] = { 1, mTiles[0] * mTiles[2], mTiles[0] };
+	std::vector<unsigned char> spread(mActive.size());
+	for (int axis = 0; axis < 3; axis++) {
+		const int n = mTiles[axis];
+		for (size_t t = 0; t < mActive.size(); t++) {
+			const int pos = (int) (t / step[axis]) % n;
+			const int lo = std::max(pos - radius, 0), hi = std::min(pos + radius, n - 1);
+			unsigned char active = 0;
+			for (int p = lo; p <= hi && !active; p++) active = mActive[t + (p - pos) * step[axis]];
+			spread[t] = active;
+		}
+		mActive.swap(spread);
+	}
+}
@@ -0,0 +1,53 @@
+// Active-tile mask over a cell centered grid.
+//
+// The cells are split into TILE^3 tiles (smaller at the upper borders when
+// a dimension is not a multiple of TILE). A tile is active when one of its
+// cells holds a value in any of the fields the mask was updated from. Passes
+// over sparse fields such as density and temperature look up the tile of
+// a cell and skip work wherever the result is known to be zero, so their
+// cost follows the volume of the smoke rather than that of the domain.
+
+#ifndef TILE_MASK_H
+#define TILE_MASK_H
+
+#include "grid_data.h"
+#include <vector>
+
+class TileMask {
+public:
+	enum { TILE = 8 };
+
+	TileMask();
+
+	// Sizes the mask for the cells of config, all tiles active.
+	void initialize(const SimConfig& config);
+
+	int tiles(int axis) const { return mTiles[axis]; }
+	int numTiles() const { return (int) mActive.size(); }
+	int numActive() const;
+
+	bool isActive(int ti, int tj, int tk) const { return mActive[ti + mTiles[0] * (tk + mTiles[2] * tj)] != 0; }
+	// The tile holding cell (i,j,k), which must be a valid cell.
+	bool isActiveCell(int i, int j, int k) const { return isActive(i / TILE, j / TILE, k / TILE); }
+
+	void setAll(bool active);
+	// Marks the tile of cell (i,j,k) active, e.g. after writing a nonzero
+	// value there. Like writes to GridData, cells outside are ignored.
+	void activateCell(int i, int j, int k);
+
+	// Active where any of the fields exceeds cutoff in magnitude. The other
+	// tiles are cleared to 0 in every field, so the fields are exactly 0
+	// outside the mask; a cutoff of 0 keeps every value.
+	void update(GridData* const fields[], int count, double cutoff = 0.0);
+
+	// Active where source has an active tile at most radius tiles away along
+	// every axis.
+	void dilate(const TileMask& source, int radius);
+
+private:
+	int mTiles[3];
+	int mDim[3];
+	std::vector<unsigned char> mActive; // Indexed like the cells, j slowest.
+};
+
+#endif // TILE_MASK_H
@@ -0,0 +1,137 @@
+#include "volume_file.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <fstream>
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+	const char MAGIC[8] = { 'S', 'M', 'O', 'K', 'E', 'V', 'O', 'L' };
+
+	uint64_t alignUp(uint64_t offset)
+	{
+		return (offset + VolumeFile::ALIGNMENT - 1) / VolumeFile::ALIGNMENT * VolumeFile::ALIGNMENT;
+	}
+
+	uint64_t channelBytes(const int32_t dim[3])
+	{
+		return (uint64_t) dim[0] * dim[1] * dim[2] * sizeof(float);
+	}
+
+}
+
+bool VolumeFile::write(const std::string& filename, const SimConfig& config, const std::vector<Channel>& channels)
+{
+	// Reused between files; one buffer per writing thread.
+	static thread_local std::vector<char> buffer;
+
+	Header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.numChannels = channels.size();
+	for (int a = 0; a < 3; a++) header.dim[a] = config.dim[a];
+	header.cellSize = config.cellSize;
+
+	std::vector<ChannelInfo> infos(channels.size());
+	uint64_t offset = sizeof(Header) + infos.size() * sizeof(ChannelInfo);
+	for (size_t c = 0; c < channels.size(); c++) {
+		memset(&infos[c], 0, sizeof(ChannelInfo));
+		strncpy(infos[c].name, channels[c].name, sizeof(infos[c].name) - 1);
+		for (int a = 0; a < 3; a++) infos[c].dim[a] = channels[c].grid->dim(a);
+		infos[c].offset = offset = alignUp(offset);
+		offset += channelBytes(infos[c].dim);
+	}
+
+	buffer.assign(offset, 0);
+	memcpy(&buffer[0], &header, sizeof(Header));
+	memcpy(&buffer[sizeof(Header)], &infos[0], infos.size() * sizeof(ChannelInfo));
+
+	for (size_t c = 0; c < channels.size(); c++) {
+		const GridData& grid = *channels[c].grid;
+		const Real* src = grid.raw();
+		float* dst = (float*) &buffer[infos[c].offset];
+		for (int k = 0; k < grid.dim(2); k++)
+			for (int j = 0; j < grid.dim(1); j++) {
+				const int row = grid.offset(0, j, k);
+				for (int i = 0; i < grid.dim(0); i++) *dst++ = (float) src[row + i];
+			}
+	}
+
+	FILE* file = fopen(filename.c_str(), "wb");
+	if (!file) return false;
+	bool ok = fwrite(&buffer[0], 1, buffer.size(), file) == buffer.size();
+	return fclose(file) == 0 && ok;
+}
+
+VolumeFile::Mapping::Mapping() : mData(0), mSize(0)
+{
+}
+
+VolumeFile::Mapping::~Mapping()
+{
+	close();
+}
+
+bool VolumeFile::Mapping::open(const std::string& filename)
+{
+	close();
+
+#ifdef _WIN32
+	std::ifstream in(filename.c_str(), std::ios::binary);
+	if (!in) return false;
+	mCopy.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	if (mCopy.empty()) return false;
+	mData = &mCopy[0];
+	mSize = mCopy.size();
+#else
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	void* data = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+		data = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd); // The mapping stays valid.
+	if (data == MAP_FAILED) return false;
+	mData = (const char*) data;
+	mSize = st.st_size;
+#endif
+
+	// Reject anything that is not a complete volume file of this version.
+	bool valid = mSize >= sizeof(Header) &&
+		memcmp(header().magic, MAGIC, sizeof(MAGIC)) == 0 &&
+		header().version == VERSION &&
+		mSize >= sizeof(Header) + (uint64_t) numChannels() * sizeof(ChannelInfo);
+	for (int c = 0; valid && c < numChannels(); c++) {
+		const ChannelInfo& info = channelInfo(c);
+		valid = info.offset % ALIGNMENT == 0 && info.offset + channelBytes(info.dim) <= mSize;
+	}
+	if (!valid) close();
+	return valid;
+}
+
+void VolumeFile::Mapping::close()
+{
+#ifndef _WIN32
+	if (mData) munmap((void*) mData, mSize);
+#endif
+	mCopy.clear();
+	mData = 0;
+	mSize = 0;
+}
+
+const float* VolumeFile::Mapping::channel(const char* name) const
+{
+	for (int c = 0; c < numChannels(); c++) {
+		if (strncmp(channelInfo(c).name, name, sizeof(channelInfo(c).name)) == 0) return channel(c);
+	}
+	return 0;
+}
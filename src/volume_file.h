@@ -0,0 +1,89 @@
+// Dense binary volume cache (.vol).
+//
+// Layout, native byte order:
+//   Header                       magic "SMOKEVOL", version, grid size, cell size
+//   ChannelInfo[numChannels]     name, size and file offset of each channel
+//   channel data                 float32, i fastest then j then k, each
+//                                channel starting on a 64 byte boundary
+//
+// Cell centered channels have the grid size, face centered ones one more
+// entry along their face axis. MACGrid writes "density", "temperature",
+// "pressure", "velocity.x", "velocity.y" and "velocity.z".
+//
+// A file is assembled in memory and written with a single fwrite. Mapping
+// reads it back through mmap, so channel() points straight into the file.
+
+#ifndef VOLUME_FILE_H
+#define VOLUME_FILE_H
+
+#include "grid_data.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace VolumeFile {
+
+	const uint32_t VERSION = 1;
+	const int ALIGNMENT = 64;
+
+	struct Header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t numChannels;
+		int32_t dim[3];
+		int32_t reserved;
+		double cellSize;
+	};
+
+	struct ChannelInfo
+	{
+		char name[24];
+		int32_t dim[3];
+		int32_t reserved;
+		uint64_t offset;  // From the start of the file.
+	};
+
+	// A grid to store under name.
+	struct Channel
+	{
+		Channel(const char* name, const GridData* grid) : name(name), grid(grid) {}
+		const char* name;
+		const GridData* grid;
+	};
+
+	// Writes channels to filename. Returns false if the file could not be written.
+	bool write(const std::string& filename, const SimConfig& config, const std::vector<Channel>& channels);
+
+	// Read-only view of a volume file.
+	class Mapping
+	{
+	public:
+		Mapping();
+		~Mapping();
+
+		// Returns false and leaves the mapping closed if filename is not a valid volume file.
+		bool open(const std::string& filename);
+		void close();
+		bool isOpen() const { return mData != 0; }
+
+		const Header& header() const { return *(const Header*) mData; }
+		int numChannels() const { return header().numChannels; }
+		const ChannelInfo& channelInfo(int c) const { return ((const ChannelInfo*) (mData + sizeof(Header)))[c]; }
+
+		// Values of the channel called name, 0 if there is none.
+		const float* channel(const char* name) const;
+		const float* channel(int c) const { return (const float*) (mData + channelInfo(c).offset); }
+
+	private:
+		Mapping(const Mapping&);
+		Mapping& operator=(const Mapping&);
+
+		const char* mData;
+		size_t mSize;
+		std::vector<char> mCopy; // Holds the file where mmap is not available.
+	};
+
+}
+
+#endif // VOLUME_FILE_H